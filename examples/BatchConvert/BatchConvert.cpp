@@ -0,0 +1,329 @@
+#include <osg/ArgumentParser>
+#include <osg/ApplicationUsage>
+#include <osg/Timer>
+
+#include <osgDB/ReadFile>
+#include <osgDB/WriteFile>
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <osgDB/fstream>
+#include <osgDB/Registry>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+//one file to convert
+struct ConvertJob
+{
+    std::string input;
+    std::string output;
+};
+
+//per file result
+struct ConvertResult
+{
+    bool ok;
+    double ms;
+    long long input_bytes;
+    long long output_bytes;
+};
+
+//totals across all workers
+struct ConvertTotals
+{
+    ConvertTotals() : files(0), failed(0), input_bytes(0), output_bytes(0) {}
+
+    std::atomic<int> files;
+    std::atomic<int> failed;
+    std::atomic<long long> input_bytes;
+    std::atomic<long long> output_bytes;
+};
+
+//WorkStealingPool
+//every worker owns a deque, pops from its front and steals from the back of
+//the other deques once its own runs dry, so a few huge tiles do not leave
+//the rest of the cores idle
+class WorkStealingPool
+{
+public:
+    typedef std::function<void()> Task;
+
+    explicit WorkStealingPool(unsigned int num_threads)
+    {
+        if (num_threads == 0) num_threads = 1;
+        for (unsigned int i = 0; i < num_threads; i++)
+        {
+            m_queues.push_back(std::unique_ptr<Queue>(new Queue()));
+        }
+    }
+
+    //tasks are dealt round robin, call before run()
+    void submit(const Task& task)
+    {
+        Queue& q = *m_queues[m_next++ % m_queues.size()];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.tasks.push_back(task);
+    }
+
+    size_t getNumThreads() const { return m_queues.size(); }
+
+    //run every submitted task and wait for all of them
+    void run()
+    {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < m_queues.size(); i++)
+        {
+            threads.push_back(std::thread(&WorkStealingPool::work, this, i));
+        }
+        for (size_t i = 0; i < threads.size(); i++)
+        {
+            threads[i].join();
+        }
+    }
+
+private:
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    bool pop(size_t index, Task& task)
+    {
+        Queue& q = *m_queues[index];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.empty()) return false;
+        task = q.tasks.front();
+        q.tasks.pop_front();
+        return true;
+    }
+
+    bool steal(size_t thief, Task& task)
+    {
+        for (size_t i = 1; i < m_queues.size(); i++)
+        {
+            Queue& q = *m_queues[(thief + i) % m_queues.size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (q.tasks.empty()) continue;
+            task = q.tasks.back();
+            q.tasks.pop_back();
+            return true;
+        }
+        return false;
+    }
+
+    //no task is submitted while running, so empty queues mean we are done
+    void work(size_t index)
+    {
+        Task task;
+        while (pop(index, task) || steal(index, task))
+        {
+            task();
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue> > m_queues;
+    size_t m_next = 0;
+};
+
+long long fileSize(const std::string& fileName)
+{
+    osgDB::ifstream file(fileName.c_str(), std::ios::binary | std::ios::ate);
+    if (!file) return 0;
+    return static_cast<long long>(file.tellg());
+}
+
+//walk a directory tree and collect every file with one of the extensions
+void collectJobs(const std::string& input_dir, const std::string& output_dir,
+    const std::set<std::string>& extensions, std::vector<ConvertJob>& jobs)
+{
+    osgDB::DirectoryContents contents = osgDB::getDirectoryContents(input_dir);
+    for (size_t i = 0; i < contents.size(); i++)
+    {
+        const std::string& name = contents[i];
+        if (name == "." || name == "..") continue;
+
+        std::string input = osgDB::concatPaths(input_dir, name);
+        std::string output = osgDB::concatPaths(output_dir, name);
+
+        osgDB::FileType type = osgDB::fileType(input);
+        if (type == osgDB::DIRECTORY)
+        {
+            collectJobs(input, output, extensions, jobs);
+        }
+        else if (type == osgDB::REGULAR_FILE
+            && extensions.count(osgDB::getLowerCaseFileExtension(name)))
+        {
+            ConvertJob job;
+            job.input = input;
+            job.output = osgDB::getNameLessExtension(output) + ".drc";
+            jobs.push_back(job);
+        }
+    }
+}
+
+//a.osg and a.osgb both map to a.drc, converted at the same time they would
+//overwrite each other. the first input in name order keeps the output, the
+//others are reported and dropped. returns the number dropped
+size_t removeDuplicateOutputs(std::vector<ConvertJob>& jobs)
+{
+    std::sort(jobs.begin(), jobs.end(),
+        [](const ConvertJob& a, const ConvertJob& b) { return a.input < b.input; });
+
+    std::vector<ConvertJob> kept;
+    size_t skipped = 0;
+    std::map<std::string, std::string> outputs;
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        std::map<std::string, std::string>::iterator itr = outputs.find(jobs[i].output);
+        if (itr != outputs.end())
+        {
+            std::cout << "skipped " << jobs[i].input << ", " << itr->second
+                << " is also converted to " << jobs[i].output << std::endl;
+            skipped++;
+            continue;
+        }
+        outputs[jobs[i].output] = jobs[i].input;
+        kept.push_back(jobs[i]);
+    }
+    jobs.swap(kept);
+    return skipped;
+}
+
+ConvertResult convert(const ConvertJob& job, const osgDB::Options* options)
+{
+    ConvertResult result;
+    result.ok = false;
+    result.input_bytes = fileSize(job.input);
+    result.output_bytes = 0;
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    osg::ref_ptr<osg::Node> node = osgDB::readNodeFile(job.input);
+    if (node.valid() && osgDB::makeDirectoryForFile(job.output))
+    {
+        result.ok = osgDB::writeNodeFile(*node, job.output, options);
+    }
+
+    result.ms = osg::Timer::instance()->delta_m(start, osg::Timer::instance()->tick());
+    if (result.ok) result.output_bytes = fileSize(job.output);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+    arguments.getApplicationUsage()->setApplicationName(arguments.getApplicationName());
+    arguments.getApplicationUsage()->setCommandLineUsage(
+        arguments.getApplicationName() + " [options] input_dir output_dir");
+    arguments.getApplicationUsage()->addCommandLineOption("-j <n>", "number of worker threads");
+    arguments.getApplicationUsage()->addCommandLineOption("-e <ext,ext>", "input extensions, default osg,osgb,osgt,ive");
+    arguments.getApplicationUsage()->addCommandLineOption("-O <string>", "option string passed to the drc writer");
+    arguments.getApplicationUsage()->addCommandLineOption("-h or --help", "display this information");
+
+    if (arguments.read("-h") || arguments.read("--help"))
+    {
+        arguments.getApplicationUsage()->write(std::cout);
+        return 0;
+    }
+
+    unsigned int num_threads = std::thread::hardware_concurrency();
+    arguments.read("-j", num_threads);
+
+    std::string ext_list = "osg,osgb,osgt,ive";
+    arguments.read("-e", ext_list);
+    std::set<std::string> extensions;
+    std::istringstream ext_stream(ext_list);
+    std::string ext;
+    while (std::getline(ext_stream, ext, ','))
+    {
+        if (!ext.empty()) extensions.insert(osgDB::convertToLowerCase(ext));
+    }
+
+    osg::ref_ptr<osgDB::Options> options = new osgDB::Options();
+    std::string option_string;
+    if (arguments.read("-O", option_string)) options->setOptionString(option_string);
+
+    if (arguments.argc() < 3)
+    {
+        arguments.getApplicationUsage()->write(std::cout);
+        return 1;
+    }
+    std::string input_dir = arguments[1];
+    std::string output_dir = arguments[2];
+
+    std::vector<ConvertJob> jobs;
+    collectJobs(input_dir, output_dir, extensions, jobs);
+    const size_t skipped = removeDuplicateOutputs(jobs);
+    if (jobs.empty())
+    {
+        std::cout << "no input files found in " << input_dir << std::endl;
+        return 1;
+    }
+
+    //load the drc plugin up front rather than racing on first use
+    if (!osgDB::Registry::instance()->getReaderWriterForExtension("drc"))
+    {
+        std::cout << "drc plugin not found" << std::endl;
+        return 1;
+    }
+
+    ConvertTotals totals;
+    std::mutex print_mutex;
+
+    WorkStealingPool pool(num_threads);
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        const ConvertJob* job = &jobs[i];
+        pool.submit([job, &options, &totals, &print_mutex]()
+        {
+            ConvertResult r = convert(*job, options.get());
+
+            totals.files++;
+            if (!r.ok) totals.failed++;
+            totals.input_bytes += r.input_bytes;
+            totals.output_bytes += r.output_bytes;
+
+            std::ostringstream line;
+            line << (r.ok ? "ok     " : "failed ") << job->input
+                << " ms=" << r.ms
+                << " in=" << r.input_bytes
+                << " out=" << r.output_bytes;
+            if (r.ms > 0.0) line << " MB/s=" << (r.input_bytes / 1048576.0) / (r.ms / 1000.0);
+
+            std::lock_guard<std::mutex> lock(print_mutex);
+            std::cout << line.str() << std::endl;
+        });
+    }
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    pool.run();
+    double seconds = osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+
+    std::cout << "files=" << totals.files
+        << " failed=" << totals.failed
+        << " skipped=" << skipped
+        << " threads=" << pool.getNumThreads()
+        << " seconds=" << seconds
+        << " in=" << totals.input_bytes
+        << " out=" << totals.output_bytes;
+    if (seconds > 0.0)
+    {
+        std::cout << " files/s=" << totals.files / seconds
+            << " MB/s=" << (totals.input_bytes / 1048576.0) / seconds;
+    }
+    std::cout << std::endl;
+
+    return (totals.failed > 0 || skipped > 0) ? 1 : 0;
+}
@@ -0,0 +1,419 @@
+#include <osg/ArgumentParser>
+#include <osg/ApplicationUsage>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/Stats>
+#include <osg/Timer>
+
+#include <osgDB/ReaderWriter>
+#include <osgDB/Registry>
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+//peak resident set size of the process in bytes. it never goes down, so
+//every case runs in a process of its own to get its own peak
+long long peakRSS()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        return static_cast<long long>(counters.PeakWorkingSetSize);
+    }
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return static_cast<long long>(usage.ru_maxrss);
+#else
+    return static_cast<long long>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+//deterministic generator so every run encodes the same data
+struct Lcg
+{
+    explicit Lcg(uint32_t seed) : state(seed) {}
+
+    float next()
+    {
+        state = state * 1664525u + 1013904223u;
+        return static_cast<float>(state >> 8) / 16777216.0f;
+    }
+
+    uint32_t state;
+};
+
+enum AttributeSet
+{
+    ATTRIBUTES_POSITION = 0,
+    ATTRIBUTES_POSITION_NORMAL = 1,
+    ATTRIBUTES_POSITION_NORMAL_UV = 2
+};
+
+const char* attributeSetName(int set)
+{
+    switch (set)
+    {
+    case ATTRIBUTES_POSITION: return "pos";
+    case ATTRIBUTES_POSITION_NORMAL: return "pos_normal";
+    default: return "pos_normal_uv";
+    }
+}
+
+//wavy height field with about num_points vertices
+osg::Node* createMesh(unsigned int num_points, int attributes)
+{
+    unsigned int side = std::max(2u, static_cast<unsigned int>(ceil(sqrt(double(num_points)))));
+
+    osg::ref_ptr<osg::Vec3Array> vertex = new osg::Vec3Array(side * side);
+    osg::ref_ptr<osg::Vec3Array> normal = new osg::Vec3Array(side * side);
+    osg::ref_ptr<osg::Vec2Array> uv0 = new osg::Vec2Array(side * side);
+    for (unsigned int y = 0; y < side; y++)
+    {
+        for (unsigned int x = 0; x < side; x++)
+        {
+            float u = float(x) / float(side - 1);
+            float v = float(y) / float(side - 1);
+            float h = 0.05f * sinf(u * 40.0f) * cosf(v * 40.0f);
+            osg::Vec3 n(-2.0f * cosf(u * 40.0f) * cosf(v * 40.0f), 2.0f * sinf(u * 40.0f) * sinf(v * 40.0f), 1.0f);
+            n.normalize();
+
+            (*vertex)[y * side + x] = osg::Vec3(u, v, h);
+            (*normal)[y * side + x] = n;
+            (*uv0)[y * side + x] = osg::Vec2(u, v);
+        }
+    }
+
+    osg::ref_ptr<osg::DrawElementsUInt> triangles = new osg::DrawElementsUInt(osg::PrimitiveSet::TRIANGLES);
+    triangles->reserve((side - 1) * (side - 1) * 6);
+    for (unsigned int y = 0; y + 1 < side; y++)
+    {
+        for (unsigned int x = 0; x + 1 < side; x++)
+        {
+            unsigned int i = y * side + x;
+            triangles->push_back(i);
+            triangles->push_back(i + 1);
+            triangles->push_back(i + side + 1);
+            triangles->push_back(i);
+            triangles->push_back(i + side + 1);
+            triangles->push_back(i + side);
+        }
+    }
+
+    osg::ref_ptr<osg::Geometry> geometry = new osg::Geometry();
+    geometry->setVertexArray(vertex);
+    if (attributes >= ATTRIBUTES_POSITION_NORMAL)
+    {
+        geometry->setNormalArray(normal);
+        geometry->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
+    }
+    if (attributes >= ATTRIBUTES_POSITION_NORMAL_UV)
+    {
+        geometry->setTexCoordArray(0, uv0);
+    }
+    geometry->addPrimitiveSet(triangles);
+
+    osg::Geode* geode = new osg::Geode();
+    geode->addDrawable(geometry);
+    return geode;
+}
+
+//num_points points in the unit cube
+osg::Node* createPointCloud(unsigned int num_points, int attributes)
+{
+    Lcg lcg(12345u);
+
+    osg::ref_ptr<osg::Vec3Array> vertex = new osg::Vec3Array(num_points);
+    osg::ref_ptr<osg::Vec3Array> normal = new osg::Vec3Array(num_points);
+    osg::ref_ptr<osg::Vec2Array> uv0 = new osg::Vec2Array(num_points);
+    for (unsigned int i = 0; i < num_points; i++)
+    {
+        osg::Vec3 v(lcg.next(), lcg.next(), lcg.next());
+        osg::Vec3 n = v - osg::Vec3(0.5f, 0.5f, 0.5f);
+        n.normalize();
+
+        (*vertex)[i] = v;
+        (*normal)[i] = n;
+        (*uv0)[i] = osg::Vec2(v.x(), v.y());
+    }
+
+    osg::ref_ptr<osg::Geometry> geometry = new osg::Geometry();
+    geometry->setVertexArray(vertex);
+    if (attributes >= ATTRIBUTES_POSITION_NORMAL)
+    {
+        geometry->setNormalArray(normal);
+        geometry->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
+    }
+    if (attributes >= ATTRIBUTES_POSITION_NORMAL_UV)
+    {
+        geometry->setTexCoordArray(0, uv0);
+    }
+    geometry->addPrimitiveSet(new osg::DrawArrays(osg::PrimitiveSet::POINTS, 0, num_points));
+
+    osg::Geode* geode = new osg::Geode();
+    geode->addDrawable(geometry);
+    return geode;
+}
+
+struct BenchmarkResult
+{
+    bool ok;
+    unsigned int vertices;
+    size_t bytes;
+    double encode_ms;
+    double decode_ms;       //draco only
+    double conversion_ms;   //draco to osg
+    double read_ms;         //plugin readNode from a stream: copy, draco decode and osg conversion
+    long long peak_rss;     //peak of the process running only this case, including its setup
+};
+
+BenchmarkResult runCase(osgDB::ReaderWriter* rw, osg::Node* node, bool point_cloud,
+    const std::string& option_string, int repeat)
+{
+    BenchmarkResult result;
+    result.ok = false;
+    result.vertices = 0;
+    result.bytes = 0;
+    result.encode_ms = result.decode_ms = result.conversion_ms = result.read_ms = 1e30;
+    result.peak_rss = 0;
+
+    osg::Geometry* geometry = node->asGeode()->getDrawable(0)->asGeometry();
+    result.vertices = geometry->getVertexArray()->getNumElements();
+
+    osg::ref_ptr<osgDB::Options> options = new osgDB::Options(
+        point_cloud ? "draco_point_cloud " + option_string : option_string);
+
+    //best of repeat runs for every stage
+    std::string encoded;
+    for (int r = 0; r < repeat; r++)
+    {
+        std::ostringstream out(std::ios::out | std::ios::binary);
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        if (!rw->writeNode(*node, out, options.get()).success()) return result;
+        result.encode_ms = std::min(result.encode_ms, osg::Timer::instance()->delta_m(start, osg::Timer::instance()->tick()));
+        encoded = out.str();
+    }
+    result.bytes = encoded.size();
+
+    //the plugin reports draco decode and osg conversion time through osg::Stats
+    osg::ref_ptr<osg::Stats> stats = new osg::Stats("drc");
+    options->setUserData(stats.get());
+    for (int r = 0; r < repeat; r++)
+    {
+        std::istringstream in(encoded, std::ios::in | std::ios::binary);
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        osgDB::ReaderWriter::ReadResult rr = rw->readNode(in, options.get());
+        double ms = osg::Timer::instance()->delta_m(start, osg::Timer::instance()->tick());
+        if (!rr.validNode()) return result;
+
+        double decode_ms = 0.0, conversion_ms = 0.0;
+        stats->getAttribute(stats->getLatestFrameNumber(), "drc read decode ms", decode_ms);
+        stats->getAttribute(stats->getLatestFrameNumber(), "drc read conversion ms", conversion_ms);
+        result.read_ms = std::min(result.read_ms, ms);
+        result.decode_ms = std::min(result.decode_ms, decode_ms);
+        result.conversion_ms = std::min(result.conversion_ms, conversion_ms);
+    }
+
+    result.peak_rss = peakRSS();
+    result.ok = true;
+    return result;
+}
+
+//one CSV or JSON line of a case
+void printResult(const BenchmarkResult& r, bool point_cloud, int attributes, unsigned int points, bool json)
+{
+    double bytes_per_vertex = r.vertices ? double(r.bytes) / r.vertices : 0.0;
+
+    if (json)
+    {
+        std::cout << "{\"kind\":\"" << (point_cloud ? "pointcloud" : "mesh") << "\""
+            << ",\"attributes\":\"" << attributeSetName(attributes) << "\""
+            << ",\"points\":" << points
+            << ",\"vertices\":" << r.vertices
+            << ",\"bytes\":" << r.bytes
+            << ",\"bytes_per_vertex\":" << bytes_per_vertex
+            << ",\"encode_ms\":" << r.encode_ms
+            << ",\"draco_decode_ms\":" << r.decode_ms
+            << ",\"osg_conversion_ms\":" << r.conversion_ms
+            << ",\"read_ms\":" << r.read_ms
+            << ",\"peak_rss\":" << r.peak_rss << "}" << std::endl;
+    }
+    else
+    {
+        std::cout << (point_cloud ? "pointcloud" : "mesh")
+            << "," << attributeSetName(attributes)
+            << "," << points
+            << "," << r.vertices
+            << "," << r.bytes
+            << "," << bytes_per_vertex
+            << "," << r.encode_ms
+            << "," << r.decode_ms
+            << "," << r.conversion_ms
+            << "," << r.read_ms
+            << "," << r.peak_rss << std::endl;
+    }
+}
+
+//run one case in this process and print its line, 0 on success
+int runSingleCase(osgDB::ReaderWriter* rw, bool point_cloud, int attributes, unsigned int points,
+    const std::string& option_string, int repeat, bool json)
+{
+    osg::ref_ptr<osg::Node> node = point_cloud
+        ? createPointCloud(points, attributes)
+        : createMesh(points, attributes);
+
+    BenchmarkResult r = runCase(rw, node.get(), point_cloud, option_string, repeat);
+    if (!r.ok) return 1;
+
+    printResult(r, point_cloud, attributes, points, json);
+    return 0;
+}
+
+//run one case in a child process of this executable and pass its line on,
+//so peak_rss is the peak of that case alone. 0 on success
+int runChildCase(const std::string& application, bool point_cloud, int attributes, unsigned int points,
+    const std::string& option_string, int repeat, bool json)
+{
+    std::ostringstream command;
+    command << "\"" << application << "\" --case " << (point_cloud ? 1 : 0) << "," << attributes << "," << points
+        << " --repeat " << repeat;
+    if (!option_string.empty()) command << " -O \"" << option_string << "\"";
+    if (json) command << " --json";
+#ifdef _WIN32
+    //cmd.exe strips the outer quotes of the whole line
+    const std::string line = "\"" + command.str() + "\"";
+#else
+    const std::string line = command.str();
+#endif
+
+    FILE* child = popen(line.c_str(), "r");
+    if (!child) return 1;
+
+    char buffer[1024];
+    bool printed = false;
+    while (fgets(buffer, sizeof(buffer), child))
+    {
+        std::cout << buffer;
+        printed = true;
+    }
+    std::cout.flush();
+    return (pclose(child) == 0 && printed) ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+    arguments.getApplicationUsage()->setApplicationName(arguments.getApplicationName());
+    arguments.getApplicationUsage()->setCommandLineUsage(arguments.getApplicationName() + " [options]");
+    arguments.getApplicationUsage()->addCommandLineOption("--sizes <n,n>", "point counts, default 1000,10000,100000,1000000,10000000,50000000");
+    arguments.getApplicationUsage()->addCommandLineOption("--repeat <n>", "runs per case, the best is reported (default 3)");
+    arguments.getApplicationUsage()->addCommandLineOption("-O <string>", "option string passed to the drc plugin");
+    arguments.getApplicationUsage()->addCommandLineOption("--json", "print JSON lines instead of CSV");
+    arguments.getApplicationUsage()->addCommandLineOption("--in-process", "run every case in this process, peak_rss is then the peak of all cases so far");
+    arguments.getApplicationUsage()->addCommandLineOption("--case <kind,attributes,points>", "run one case only, used for the child processes");
+    arguments.getApplicationUsage()->addCommandLineOption("-h or --help", "display this information");
+
+    if (arguments.read("-h") || arguments.read("--help"))
+    {
+        arguments.getApplicationUsage()->write(std::cout);
+        return 0;
+    }
+
+    std::string size_list = "1000,10000,100000,1000000,10000000,50000000";
+    arguments.read("--sizes", size_list);
+    std::vector<unsigned int> sizes;
+    std::istringstream size_stream(size_list);
+    std::string size;
+    while (std::getline(size_stream, size, ','))
+    {
+        if (!size.empty()) sizes.push_back(static_cast<unsigned int>(atol(size.c_str())));
+    }
+
+    int repeat = 3;
+    arguments.read("--repeat", repeat);
+    repeat = std::max(repeat, 1);
+
+    std::string option_string;
+    arguments.read("-O", option_string);
+
+    bool json = arguments.read("--json");
+    bool in_process = arguments.read("--in-process");
+
+    std::string single_case;
+    arguments.read("--case", single_case);
+
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension("drc");
+    if (!rw)
+    {
+        std::cerr << "drc plugin not found" << std::endl;
+        return 1;
+    }
+
+    //child process, one line without header
+    if (!single_case.empty())
+    {
+        int kind = 0, attributes = 0;
+        unsigned int points = 0;
+        if (sscanf(single_case.c_str(), "%d,%d,%u", &kind, &attributes, &points) != 3) return 1;
+        return runSingleCase(rw, kind == 1, attributes, points, option_string, repeat, json);
+    }
+
+    if (!json)
+    {
+        std::cout << "kind,attributes,points,vertices,bytes,bytes_per_vertex,"
+            "encode_ms,draco_decode_ms,osg_conversion_ms,read_ms,peak_rss" << std::endl;
+    }
+
+    int failed = 0;
+    for (int kind = 0; kind < 2; kind++)
+    {
+        bool point_cloud = (kind == 1);
+        for (size_t s = 0; s < sizes.size(); s++)
+        {
+            for (int attributes = ATTRIBUTES_POSITION; attributes <= ATTRIBUTES_POSITION_NORMAL_UV; attributes++)
+            {
+                int status = in_process
+                    ? runSingleCase(rw, point_cloud, attributes, sizes[s], option_string, repeat, json)
+                    : runChildCase(arguments.getApplicationName(), point_cloud, attributes, sizes[s], option_string, repeat, json);
+                if (status != 0)
+                {
+                    failed++;
+                    std::cerr << "failed: " << (point_cloud ? "pointcloud " : "mesh ")
+                        << attributeSetName(attributes) << " " << sizes[s] << std::endl;
+                }
+            }
+        }
+    }
+
+    return failed > 0 ? 1 : 0;
+}
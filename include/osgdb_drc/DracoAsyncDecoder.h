@@ -0,0 +1,289 @@
+#ifndef OSGDB_DRC_DRACO_ASYNC_DECODER_H
+#define OSGDB_DRC_DRACO_ASYNC_DECODER_H
+
+#include <osg/Referenced>
+#include <osg/ref_ptr>
+
+#include <osgDB/Options>
+#include <osgDB/ReaderWriter>
+#include <osgDB/Registry>
+
+#include <osgdb_drc/DracoMemoryStream.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//DracoDecodeRequest
+//handle of one submitted decode. the priority can be changed while the
+//request waits, cancel() drops it from the queue or discards its result.
+//the callback runs on a worker thread, or on the thread that submitted or
+//shut down for rejected and cancelled requests. it must not block, a worker
+//waiting in it decodes nothing, and it may release the decoder
+class DracoDecodeRequest
+    : public osg::Referenced
+{
+public:
+    typedef osgDB::ReaderWriter::ReadResult ReadResult;
+    typedef std::function<void(const ReadResult&)> Callback;
+
+    //higher priority is decoded first
+    void setPriority(float priority) { m_priority = priority; }
+    float getPriority() const { return m_priority; }
+
+    void cancel() { m_cancelled = true; }
+    bool isCancelled() const { return m_cancelled; }
+
+    //ready once the request was decoded, cancelled or rejected
+    std::shared_future<ReadResult> getFuture() const { return m_future; }
+
+protected:
+
+    friend class DracoAsyncDecoder;
+
+    DracoDecodeRequest(float priority, const Callback& callback)
+        : m_priority(priority)
+        , m_cancelled(false)
+        , m_callback(callback)
+        , m_future(m_promise.get_future().share())
+    {
+    }
+    virtual ~DracoDecodeRequest() {}
+
+    //set the result exactly once and run the callback
+    void finish(const ReadResult& result)
+    {
+        m_promise.set_value(result);
+        if (m_callback) m_callback(result);
+    }
+
+    static ReadResult cancelledResult() { return ReadResult("draco decode cancelled"); }
+
+    std::atomic<float> m_priority;
+    std::atomic<bool> m_cancelled;
+    Callback m_callback;
+    std::promise<ReadResult> m_promise;
+    std::shared_future<ReadResult> m_future;
+
+    //what to decode, a file name or an in memory buffer
+    std::string m_fileName;
+    std::vector<char> m_buffer;
+    osg::ref_ptr<const osgDB::Options> m_options;
+};
+
+//DracoAsyncDecoder
+//decodes drc files or buffers on a fixed number of worker threads through
+//the registered drc ReaderWriter. at most max_pending requests wait at any
+//time, a new request replaces the lowest priority waiting one or is
+//rejected when it has no higher priority itself.
+//
+//  osg::ref_ptr<DracoAsyncDecoder> decoder = new DracoAsyncDecoder(4, 256);
+//  osg::ref_ptr<DracoDecodeRequest> request = decoder->readNode("tile.drc", options, priority);
+//  ...
+//  request->setPriority(new_priority);     //tile moved in the view
+//  request->cancel();                      //tile left the view
+//  osg::ref_ptr<osg::Node> node = request->getFuture().get().getNode();
+class DracoAsyncDecoder
+    : public osg::Referenced
+{
+public:
+    typedef DracoDecodeRequest::ReadResult ReadResult;
+    typedef DracoDecodeRequest::Callback Callback;
+
+    //num_threads 0 uses every core, max_pending 0 does not limit the queue
+    DracoAsyncDecoder(unsigned int num_threads = 0, size_t max_pending = 0)
+        : m_readerWriter(osgDB::Registry::instance()->getReaderWriterForExtension("drc"))
+        , m_maxPending(max_pending)
+        , m_done(false)
+    {
+        if (num_threads == 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned int i = 0; i < num_threads; i++)
+        {
+            m_threads.push_back(std::thread(&DracoAsyncDecoder::work, this));
+        }
+    }
+
+    //false when the drc plugin could not be loaded, every request then fails
+    bool valid() const { return m_readerWriter.valid(); }
+
+    osg::ref_ptr<DracoDecodeRequest> readNode(const std::string& fileName,
+        const osgDB::Options* options = NULL, float priority = 0.0f, const Callback& callback = Callback())
+    {
+        osg::ref_ptr<DracoDecodeRequest> request = new DracoDecodeRequest(priority, callback);
+        request->m_fileName = fileName;
+        request->m_options = options;
+        submit(request.get());
+        return request;
+    }
+
+    //the buffer is copied once, it may be released once this returns
+    osg::ref_ptr<DracoDecodeRequest> readNode(const char* data, size_t size,
+        const osgDB::Options* options = NULL, float priority = 0.0f, const Callback& callback = Callback())
+    {
+        return readNode(std::vector<char>(data, data + size), options, priority, callback);
+    }
+
+    //the buffer is moved into the request and decoded in place, no copy
+    osg::ref_ptr<DracoDecodeRequest> readNode(std::vector<char>&& buffer,
+        const osgDB::Options* options = NULL, float priority = 0.0f, const Callback& callback = Callback())
+    {
+        osg::ref_ptr<DracoDecodeRequest> request = new DracoDecodeRequest(priority, callback);
+        request->m_buffer = std::move(buffer);
+        request->m_options = options;
+        submit(request.get());
+        return request;
+    }
+
+    size_t getNumPending() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_pending.size();
+    }
+
+    //waiting requests are cancelled, running ones are finished. a worker
+    //shutting the decoder down from a callback is not joined with itself,
+    //it leaves once its callback returns
+    void shutdown()
+    {
+        std::vector<osg::ref_ptr<DracoDecodeRequest> > pending;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_done) return;
+            m_done = true;
+            pending.swap(m_pending);
+        }
+        m_condition.notify_all();
+
+        for (size_t i = 0; i < pending.size(); i++)
+        {
+            pending[i]->finish(DracoDecodeRequest::cancelledResult());
+        }
+        for (size_t i = 0; i < m_threads.size(); i++)
+        {
+            if (m_threads[i].get_id() == std::this_thread::get_id()) m_threads[i].detach();
+            else m_threads[i].join();
+        }
+    }
+
+protected:
+
+    virtual ~DracoAsyncDecoder()
+    {
+        shutdown();
+    }
+
+    void submit(DracoDecodeRequest* request)
+    {
+        osg::ref_ptr<DracoDecodeRequest> rejected;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_done || !m_readerWriter.valid())
+            {
+                rejected = request;
+            }
+            else
+            {
+                m_pending.push_back(request);
+                if (m_maxPending > 0 && m_pending.size() > m_maxPending)
+                {
+                    //drop the lowest priority request, possibly the new one
+                    size_t lowest = takeLowest();
+                    rejected = m_pending[lowest];
+                    m_pending.erase(m_pending.begin() + lowest);
+                }
+            }
+        }
+
+        if (rejected.valid())
+        {
+            rejected->finish(rejected == request && !m_readerWriter.valid()
+                ? ReadResult(ReadResult::FILE_NOT_HANDLED) : DracoDecodeRequest::cancelledResult());
+        }
+        if (rejected != request) m_condition.notify_one();
+    }
+
+    //index of the lowest priority waiting request, the newest one on ties
+    size_t takeLowest() const
+    {
+        size_t lowest = m_pending.size() - 1;
+        for (size_t i = 0; i < m_pending.size(); i++)
+        {
+            if (m_pending[i]->getPriority() < m_pending[lowest]->getPriority()) lowest = i;
+        }
+        return lowest;
+    }
+
+    //highest priority waiting request, NULL once shut down
+    osg::ref_ptr<DracoDecodeRequest> next()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condition.wait(lock, [this]() { return m_done || !m_pending.empty(); });
+        if (m_pending.empty()) return NULL;
+
+        size_t best = 0;
+        for (size_t i = 1; i < m_pending.size(); i++)
+        {
+            if (m_pending[i]->getPriority() > m_pending[best]->getPriority()) best = i;
+        }
+        osg::ref_ptr<DracoDecodeRequest> request = m_pending[best];
+        m_pending.erase(m_pending.begin() + best);
+        return request;
+    }
+
+    void work()
+    {
+        osg::ref_ptr<DracoDecodeRequest> request;
+        while ((request = next()).valid())
+        {
+            //cancelled while waiting, finished without decoding
+            ReadResult result = DracoDecodeRequest::cancelledResult();
+            if (!request->isCancelled()) result = decode(*request);
+
+            //the decode cannot be interrupted, a late cancel drops the result.
+            //the callback may release the last reference to the decoder, the
+            //worker then destroys it and must not touch it afterwards. a count
+            //that was 0 already means the destructor runs elsewhere and joins
+            const bool alive = ref() > 1;
+            request->finish(request->isCancelled() ? DracoDecodeRequest::cancelledResult() : result);
+            request = NULL;
+            if (unref_nodelete() == 0 && alive)
+            {
+                delete this;
+                return;
+            }
+        }
+    }
+
+    ReadResult decode(DracoDecodeRequest& request) const
+    {
+        if (!request.m_fileName.empty())
+        {
+            return m_readerWriter->readNode(request.m_fileName, request.m_options.get());
+        }
+
+        //the plugin decodes straight from the request's storage
+        DracoMemoryStreamBuf buffer(request.m_buffer.data(), request.m_buffer.size());
+        std::istream in(&buffer);
+        ReadResult result = m_readerWriter->readNode(in, request.m_options.get());
+        std::vector<char>().swap(request.m_buffer);
+        return result;
+    }
+
+    osg::ref_ptr<osgDB::ReaderWriter> m_readerWriter;
+    size_t m_maxPending;
+    bool m_done;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::vector<osg::ref_ptr<DracoDecodeRequest> > m_pending;
+    std::vector<std::thread> m_threads;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef OSGDB_DRC_DRACO_MEMORY_STREAM_H
+#define OSGDB_DRC_DRACO_MEMORY_STREAM_H
+
+#include <osgDB/Options>
+#include <osgDB/ReaderWriter>
+#include <osgDB/Registry>
+
+#include <istream>
+#include <streambuf>
+
+//DracoMemoryStreamBuf
+//read only streambuf over memory the caller owns. when a stream passed to
+//the drc plugin's readNode uses it, the plugin decodes the rest of the
+//stream in place instead of reading it into a buffer of its own
+class DracoMemoryStreamBuf
+    : public std::streambuf
+{
+public:
+    DracoMemoryStreamBuf(const char* data, size_t size)
+    {
+        char* begin = const_cast<char*>(data);
+        setg(begin, begin, begin + size);
+    }
+
+    //data not read yet
+    const char* current() const { return gptr(); }
+    size_t remaining() const { return static_cast<size_t>(egptr() - gptr()); }
+
+protected:
+
+    virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+        std::ios_base::openmode which = std::ios_base::in)
+    {
+        if (!(which & std::ios_base::in)) return pos_type(off_type(-1));
+
+        char* base = dir == std::ios_base::beg ? eback() : (dir == std::ios_base::cur ? gptr() : egptr());
+        if (off < eback() - base || off > egptr() - base) return pos_type(off_type(-1));
+        setg(eback(), base + off, egptr());
+        return pos_type(gptr() - eback());
+    }
+
+    virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which = std::ios_base::in)
+    {
+        return seekoff(off_type(pos), std::ios_base::beg, which);
+    }
+};
+
+//decode a drc file already in memory through the registered drc plugin,
+//the data is not copied and only has to live until this returns
+//
+//  osgDB::ReaderWriter::ReadResult rr = readDracoNode(data, size, options);
+//  osg::ref_ptr<osg::Node> node = rr.getNode();
+inline osgDB::ReaderWriter::ReadResult readDracoNode(const char* data, size_t size,
+    const osgDB::Options* options = NULL)
+{
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension("drc");
+    if (!rw) return osgDB::ReaderWriter::ReadResult(osgDB::ReaderWriter::ReadResult::FILE_NOT_HANDLED);
+
+    DracoMemoryStreamBuf buffer(data, size);
+    std::istream in(&buffer);
+    return rw->readNode(in, options);
+}
+
+#endif
@@ -0,0 +1,288 @@
+#ifndef OSGDB_DRC_DRACO_CONTAINER_H
+#define OSGDB_DRC_DRACO_CONTAINER_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <limits>
+#include <ostream>
+#include <string>
+#include <vector>
+
+//DracoContainer
+//several draco payloads plus the scene structure around them in one file.
+//values are written in host byte order, which like draco itself assumes
+//little endian.
+//
+//  char[8]   magic "OSGDRACO"
+//  uint32    version
+//  uint32    node count
+//  uint32    blob count
+//  node      [node count]
+//  blob      [blob count]   uint32 type, uint64 offset, uint64 size
+//  bytes     blob data, offsets are relative to the start of this section
+//
+//  node:     int32 parent, uint32 type, int32 payload, int32 stateset,
+//            float64 matrix[16], float32 bounds[6], float32 range[2],
+//            uint32 name length, char name[length]
+//
+//nodes are stored parents first, payload and stateset index the blob table.
+//bounds are min xyz, max xyz of everything below the node, min > max when
+//unknown. range is the min / max distance of a child of a LOD node. older
+//versions lack bounds (1) or range (1, 2) and are still read.
+
+static const char DRACO_CONTAINER_MAGIC[8] = { 'O', 'S', 'G', 'D', 'R', 'A', 'C', 'O' };
+static const uint32_t DRACO_CONTAINER_VERSION = 3;
+
+enum DracoContainerNodeType
+{
+    DRACO_NODE_GROUP = 0,
+    DRACO_NODE_MATRIX_TRANSFORM = 1,
+    DRACO_NODE_GEODE = 2,
+    DRACO_NODE_GEOMETRY = 3,
+    DRACO_NODE_TILE = 4,        //group of one spatial chunk, with bounds
+    DRACO_NODE_LOD = 5          //children are levels with their range
+};
+
+enum DracoContainerBlobType
+{
+    DRACO_BLOB_GEOMETRY = 0,    //draco encoded mesh or point cloud
+    DRACO_BLOB_STATESET = 1,    //osgb serialized osg::StateSet
+    DRACO_BLOB_LINES = 2        //draco point cloud, every two points are a line
+};
+
+struct DracoContainerNode
+{
+    DracoContainerNode()
+        : parent(-1)
+        , type(DRACO_NODE_GROUP)
+        , payload(-1)
+        , stateset(-1)
+    {
+        for (int i = 0; i < 16; i++) matrix[i] = (i % 5 == 0) ? 1.0 : 0.0;
+        for (int i = 0; i < 3; i++)
+        {
+            bounds[i] = std::numeric_limits<float>::max();
+            bounds[i + 3] = -std::numeric_limits<float>::max();
+        }
+        range[0] = 0.0f;
+        range[1] = std::numeric_limits<float>::max();
+    }
+
+    bool hasBounds() const { return bounds[0] <= bounds[3]; }
+
+    int32_t parent;
+    uint32_t type;
+    int32_t payload;
+    int32_t stateset;
+    double matrix[16];
+    float bounds[6];
+    float range[2];
+    std::string name;
+};
+
+class DracoContainer
+{
+public:
+
+    static bool isContainer(const char* data, size_t size)
+    {
+        return size >= sizeof(DRACO_CONTAINER_MAGIC)
+            && memcmp(data, DRACO_CONTAINER_MAGIC, sizeof(DRACO_CONTAINER_MAGIC)) == 0;
+    }
+
+    int addNode(const DracoContainerNode& node)
+    {
+        m_nodes.push_back(node);
+        return static_cast<int>(m_nodes.size() - 1);
+    }
+
+    int addBlob(uint32_t type, const std::string& data)
+    {
+        Blob blob;
+        blob.type = type;
+        blob.storage = data;
+        blob.ref = NULL;
+        blob.size = data.size();
+        m_blobs.push_back(blob);
+        return static_cast<int>(m_blobs.size() - 1);
+    }
+
+    size_t getNumNodes() const { return m_nodes.size(); }
+    const DracoContainerNode& getNode(size_t i) const { return m_nodes[i]; }
+
+    size_t getNumBlobs() const { return m_blobs.size(); }
+    uint32_t getBlobType(size_t i) const { return m_blobs[i].type; }
+    const char* getBlobData(size_t i) const { return m_blobs[i].ref ? m_blobs[i].ref : m_blobs[i].storage.data(); }
+    size_t getBlobSize(size_t i) const { return m_blobs[i].size; }
+
+    bool write(std::ostream& out) const
+    {
+        out.write(DRACO_CONTAINER_MAGIC, sizeof(DRACO_CONTAINER_MAGIC));
+        writeValue(out, DRACO_CONTAINER_VERSION);
+        writeValue(out, static_cast<uint32_t>(m_nodes.size()));
+        writeValue(out, static_cast<uint32_t>(m_blobs.size()));
+
+        for (size_t i = 0; i < m_nodes.size(); i++)
+        {
+            const DracoContainerNode& node = m_nodes[i];
+            writeValue(out, node.parent);
+            writeValue(out, node.type);
+            writeValue(out, node.payload);
+            writeValue(out, node.stateset);
+            out.write(reinterpret_cast<const char*>(node.matrix), sizeof(node.matrix));
+            out.write(reinterpret_cast<const char*>(node.bounds), sizeof(node.bounds));
+            out.write(reinterpret_cast<const char*>(node.range), sizeof(node.range));
+            writeValue(out, static_cast<uint32_t>(node.name.size()));
+            out.write(node.name.data(), node.name.size());
+        }
+
+        uint64_t offset = 0;
+        for (size_t i = 0; i < m_blobs.size(); i++)
+        {
+            writeValue(out, m_blobs[i].type);
+            writeValue(out, offset);
+            writeValue(out, static_cast<uint64_t>(m_blobs[i].size));
+            offset += m_blobs[i].size;
+        }
+
+        for (size_t i = 0; i < m_blobs.size(); i++)
+        {
+            out.write(getBlobData(i), m_blobs[i].size);
+        }
+
+        return !out.fail();
+    }
+
+    //parse a container, blobs point into data which must outlive the container
+    bool read(const char* data, size_t size)
+    {
+        m_nodes.clear();
+        m_blobs.clear();
+
+        if (!isContainer(data, size)) return false;
+        const char* cur = data + sizeof(DRACO_CONTAINER_MAGIC);
+        const char* end = data + size;
+
+        uint32_t version, num_nodes, num_blobs;
+        if (!readValue(cur, end, version) || version < 1 || version > DRACO_CONTAINER_VERSION) return false;
+        if (!readValue(cur, end, num_nodes) || !readValue(cur, end, num_blobs)) return false;
+
+        //counts come from the file, check them against the bytes left before
+        //anything is sized by them
+        const uint64_t left = static_cast<uint64_t>(end - cur);
+        if (static_cast<uint64_t>(num_nodes) * nodeRecordSize(version) > left
+            || static_cast<uint64_t>(num_blobs) * BLOB_RECORD_SIZE > left)
+        {
+            return false;
+        }
+        m_nodes.reserve(num_nodes);
+        m_blobs.reserve(num_blobs);
+
+        for (uint32_t i = 0; i < num_nodes; i++)
+        {
+            DracoContainerNode node;
+            uint32_t name_size;
+            if (!readValue(cur, end, node.parent)
+                || !readValue(cur, end, node.type)
+                || !readValue(cur, end, node.payload)
+                || !readValue(cur, end, node.stateset)
+                || !readBytes(cur, end, node.matrix, sizeof(node.matrix))
+                || (version >= 2 && !readBytes(cur, end, node.bounds, sizeof(node.bounds)))
+                || (version >= 3 && !readBytes(cur, end, node.range, sizeof(node.range)))
+                || !readValue(cur, end, name_size)
+                || static_cast<size_t>(end - cur) < name_size)
+            {
+                return false;
+            }
+            node.name.assign(cur, name_size);
+            cur += name_size;
+
+            //parents first, so the tree can be built in one pass
+            if (node.parent >= static_cast<int32_t>(i)) return false;
+            m_nodes.push_back(node);
+        }
+
+        std::vector<uint64_t> offsets(num_blobs);
+        for (uint32_t i = 0; i < num_blobs; i++)
+        {
+            Blob blob;
+            uint64_t blob_size;
+            if (!readValue(cur, end, blob.type)
+                || !readValue(cur, end, offsets[i])
+                || !readValue(cur, end, blob_size))
+            {
+                return false;
+            }
+            blob.size = static_cast<size_t>(blob_size);
+            m_blobs.push_back(blob);
+        }
+
+        const size_t data_size = static_cast<size_t>(end - cur);
+        for (uint32_t i = 0; i < num_blobs; i++)
+        {
+            if (offsets[i] > data_size || m_blobs[i].size > data_size - offsets[i]) return false;
+            m_blobs[i].ref = cur + offsets[i];
+        }
+
+        for (size_t i = 0; i < m_nodes.size(); i++)
+        {
+            if (m_nodes[i].payload >= static_cast<int32_t>(num_blobs)
+                || m_nodes[i].stateset >= static_cast<int32_t>(num_blobs))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+private:
+
+    struct Blob
+    {
+        Blob() : type(DRACO_BLOB_GEOMETRY), ref(NULL), size(0) {}
+
+        uint32_t type;
+        std::string storage;
+        const char* ref;
+        size_t size;
+    };
+
+    //uint32 type, uint64 offset, uint64 size
+    static const uint64_t BLOB_RECORD_SIZE = 20;
+
+    //smallest node record of a version, the one with an empty name
+    static uint64_t nodeRecordSize(uint32_t version)
+    {
+        uint64_t size = 4 * sizeof(int32_t) + 16 * sizeof(double) + sizeof(uint32_t);
+        if (version >= 2) size += 6 * sizeof(float);
+        if (version >= 3) size += 2 * sizeof(float);
+        return size;
+    }
+
+    template<typename T>
+    static void writeValue(std::ostream& out, const T& value)
+    {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    static bool readBytes(const char*& cur, const char* end, void* value, size_t size)
+    {
+        if (static_cast<size_t>(end - cur) < size) return false;
+        memcpy(value, cur, size);
+        cur += size;
+        return true;
+    }
+
+    template<typename T>
+    static bool readValue(const char*& cur, const char* end, T& value)
+    {
+        return readBytes(cur, end, &value, sizeof(T));
+    }
+
+    std::vector<DracoContainerNode> m_nodes;
+    std::vector<Blob> m_blobs;
+};
+
+#endif
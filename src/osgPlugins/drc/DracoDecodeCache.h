@@ -0,0 +1,288 @@
+#ifndef OSGDB_DRC_DRACO_DECODE_CACHE_H
+#define OSGDB_DRC_DRACO_DECODE_CACHE_H
+
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/NodeVisitor>
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <osgDB/Registry>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+
+//DracoDecodeCache
+//decoded scene graphs by the hash of the draco data and the read options.
+//the cache is bounded by the bytes of the arrays and primitive sets it
+//holds, the least recently used entries are evicted first. a hit returns
+//new nodes and Geometry sharing the cached arrays, so a caller can change
+//its copy without touching the cache. optionally entries are also kept as
+//osgb files in a directory to survive restarts.
+class DracoDecodeCache
+{
+public:
+
+    struct Key
+    {
+        uint64_t hash;
+        uint64_t size;
+        std::string options;
+
+        bool operator<(const Key& rhs) const
+        {
+            if (hash != rhs.hash) return hash < rhs.hash;
+            if (size != rhs.size) return size < rhs.size;
+            return options < rhs.options;
+        }
+    };
+
+    DracoDecodeCache()
+        : m_capacity(0)
+        , m_bytes(0)
+        , m_hits(0)
+        , m_misses(0)
+        , m_evictions(0)
+    {
+    }
+
+    static Key makeKey(const char* data, size_t size, const std::string& options)
+    {
+        Key key;
+        key.hash = hashData(data, size);
+        key.size = size;
+        key.options = options;
+        return key;
+    }
+
+    //64 bit multiply-xor hash over 8 byte words, much faster than a byte
+    //wise FNV on files of hundreds of MB
+    static uint64_t hashData(const char* data, size_t size)
+    {
+        uint64_t hash = 14695981039346656037ULL ^ size;
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8)
+        {
+            uint64_t word;
+            memcpy(&word, data + i, 8);
+            hash = (hash ^ word) * 1099511628211ULL;
+            hash ^= hash >> 32;
+        }
+        for (; i < size; i++)
+        {
+            hash = (hash ^ static_cast<unsigned char>(data[i])) * 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    //the cache is shared by every reader in the process, so a caller asking
+    //for less than another one never shrinks it and evicts nothing
+    void growCapacity(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (bytes > m_capacity) m_capacity = bytes;
+    }
+
+    //copy of the cached node, NULL on a miss
+    osg::ref_ptr<osg::Node> get(const Key& key)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        EntryMap::iterator itr = m_entries.find(key);
+        if (itr == m_entries.end())
+        {
+            m_misses++;
+            return NULL;
+        }
+
+        m_hits++;
+        m_lru.splice(m_lru.begin(), m_lru, itr->second.lru);
+        return share(*itr->second.node);
+    }
+
+    //keep node, which must not be changed afterwards. returns the number of
+    //evicted entries
+    size_t insert(const Key& key, osg::Node* node)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        EntryMap::iterator itr = m_entries.find(key);
+        if (itr != m_entries.end())
+        {
+            m_bytes -= itr->second.bytes;
+            m_lru.erase(itr->second.lru);
+            m_entries.erase(itr);
+        }
+
+        Entry entry;
+        entry.node = node;
+        entry.bytes = nodeBytes(*node);
+        m_lru.push_front(key);
+        entry.lru = m_lru.begin();
+        m_entries[key] = entry;
+        m_bytes += entry.bytes;
+        return evict();
+    }
+
+    size_t getNumHits() const { std::lock_guard<std::mutex> lock(m_mutex); return m_hits; }
+    size_t getNumMisses() const { std::lock_guard<std::mutex> lock(m_mutex); return m_misses; }
+    size_t getNumEvictions() const { std::lock_guard<std::mutex> lock(m_mutex); return m_evictions; }
+    size_t getNumBytes() const { std::lock_guard<std::mutex> lock(m_mutex); return m_bytes; }
+
+    //new nodes and Geometry, arrays and primitive sets stay shared
+    static osg::ref_ptr<osg::Node> share(const osg::Node& node)
+    {
+        return static_cast<osg::Node*>(node.clone(osg::CopyOp::DEEP_COPY_NODES | osg::CopyOp::DEEP_COPY_DRAWABLES));
+    }
+
+    //osgb file of an entry in dir, NULL when there is none
+    static osg::ref_ptr<osg::Node> readDisk(const std::string& dir, const Key& key)
+    {
+        const std::string file = diskFile(dir, key);
+        osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension("osgb");
+        if (!rw || !osgDB::fileExists(file)) return NULL;
+        return rw->readNode(file, NULL).getNode();
+    }
+
+    //written under a temporary name first, so readers never see half a file.
+    //the name is unique per process and call, two threads or processes that
+    //miss on the same data each write their own and the last rename wins
+    static bool writeDisk(const std::string& dir, const Key& key, const osg::Node& node)
+    {
+        osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension("osgb");
+        if (!rw || !osgDB::makeDirectory(dir)) return false;
+
+        static std::atomic<unsigned int> counter(0);
+        char suffix[64];
+#ifdef _WIN32
+        snprintf(suffix, sizeof(suffix), ".%d.%u.tmp.osgb", _getpid(), counter++);
+#else
+        snprintf(suffix, sizeof(suffix), ".%d.%u.tmp.osgb", static_cast<int>(getpid()), counter++);
+#endif
+
+        const std::string file = diskFile(dir, key);
+        const std::string temp = file + suffix;
+        if (!rw->writeNode(node, temp, NULL).success())
+        {
+            remove(temp.c_str());
+            return false;
+        }
+#ifdef _WIN32
+        //rename does not replace an existing file here
+        remove(file.c_str());
+#endif
+        if (rename(temp.c_str(), file.c_str()) != 0)
+        {
+            remove(temp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+
+    struct Entry
+    {
+        osg::ref_ptr<osg::Node> node;
+        size_t bytes;
+        std::list<Key>::iterator lru;
+    };
+    typedef std::map<Key, Entry> EntryMap;
+
+    //bytes of every distinct array and primitive set below a node
+    class ByteCounter : public osg::NodeVisitor
+    {
+    public:
+        ByteCounter()
+            : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN)
+            , bytes(0)
+        {
+        }
+
+        virtual void apply(osg::Geode& geode)
+        {
+            for (unsigned int i = 0; i < geode.getNumDrawables(); i++)
+            {
+                osg::Geometry* geometry = geode.getDrawable(i)->asGeometry();
+                if (!geometry) continue;
+
+                add(geometry->getVertexArray());
+                add(geometry->getNormalArray());
+                add(geometry->getColorArray());
+                for (unsigned int unit = 0; unit < geometry->getNumTexCoordArrays(); unit++)
+                {
+                    add(geometry->getTexCoordArray(unit));
+                }
+                for (unsigned int index = 0; index < geometry->getNumVertexAttribArrays(); index++)
+                {
+                    add(geometry->getVertexAttribArray(index));
+                }
+                for (unsigned int p = 0; p < geometry->getNumPrimitiveSets(); p++)
+                {
+                    add(geometry->getPrimitiveSet(p));
+                }
+            }
+            traverse(geode);
+        }
+
+        void add(const osg::BufferData* data)
+        {
+            if (data && seen.insert(std::make_pair(data, true)).second) bytes += data->getTotalDataSize();
+        }
+
+        std::map<const osg::BufferData*, bool> seen;
+        size_t bytes;
+    };
+
+    static size_t nodeBytes(osg::Node& node)
+    {
+        ByteCounter counter;
+        node.accept(counter);
+        return counter.bytes;
+    }
+
+    static std::string diskFile(const std::string& dir, const Key& key)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "%016llx_%016llx.osgb",
+            static_cast<unsigned long long>(key.hash),
+            static_cast<unsigned long long>(hashData(key.options.data(), key.options.size())));
+        return osgDB::concatPaths(dir, name);
+    }
+
+    //caller holds the mutex, the newest entry is kept even above capacity
+    size_t evict()
+    {
+        size_t evicted = 0;
+        while (m_bytes > m_capacity && m_lru.size() > 1)
+        {
+            EntryMap::iterator itr = m_entries.find(m_lru.back());
+            m_bytes -= itr->second.bytes;
+            m_entries.erase(itr);
+            m_lru.pop_back();
+            evicted++;
+        }
+        m_evictions += evicted;
+        return evicted;
+    }
+
+    mutable std::mutex m_mutex;
+    size_t m_capacity;
+    size_t m_bytes;
+    size_t m_hits;
+    size_t m_misses;
+    size_t m_evictions;
+    std::list<Key> m_lru;
+    EntryMap m_entries;
+};
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef OSGDB_DRC_DRACO_STATISTICS_H
+#define OSGDB_DRC_DRACO_STATISTICS_H
+
+#include <osg/Notify>
+#include <osg/Stats>
+#include <osgDB/Options>
+
+#include <OpenThreads/ScopedLock>
+
+#include <string>
+
+//DracoStatistics
+//per call numbers of one readNode / writeNode. when the caller puts an
+//osg::Stats in the Options user data they are published there under
+//"drc read ..." / "drc write ..." for the latest frame, together with totals
+//over all calls in that frame ("... total") so telemetry can aggregate them.
+struct DracoStatistics
+{
+    DracoStatistics()
+        : decode_ms(0.0)
+        , conversion_ms(0.0)
+        , optimize_ms(0.0)
+        , kdtree_ms(0.0)
+        , flatten_ms(0.0)
+        , encode_ms(0.0)
+        , input_bytes(0.0)
+        , output_bytes(0.0)
+        , vertices(0.0)
+        , faces(0.0)
+        , points_before_dedup(0.0)
+        , points_after_dedup(0.0)
+        , payloads(0.0)
+        , cache_hits(0.0)
+        , cache_misses(0.0)
+        , cache_evictions(0.0)
+    {
+    }
+
+    double decode_ms;           //draco decode
+    double conversion_ms;       //draco to osg arrays and primitives
+    double optimize_ms;         //vertex cache reordering of the decoded triangles
+    double kdtree_ms;           //osg::KdTree building
+    double flatten_ms;          //scene graph to GeometryData
+    double encode_ms;           //draco encode
+    double input_bytes;
+    double output_bytes;
+    double vertices;
+    double faces;
+    double points_before_dedup;
+    double points_after_dedup;
+    double payloads;
+    double cache_hits;          //reads answered by the decode cache
+    double cache_misses;
+    double cache_evictions;
+
+    //sum of the numbers of separately timed parts, e.g. chunks encoded on other threads
+    void add(const DracoStatistics& other)
+    {
+        decode_ms += other.decode_ms;
+        conversion_ms += other.conversion_ms;
+        optimize_ms += other.optimize_ms;
+        kdtree_ms += other.kdtree_ms;
+        flatten_ms += other.flatten_ms;
+        encode_ms += other.encode_ms;
+        input_bytes += other.input_bytes;
+        output_bytes += other.output_bytes;
+        vertices += other.vertices;
+        faces += other.faces;
+        points_before_dedup += other.points_before_dedup;
+        points_after_dedup += other.points_after_dedup;
+        payloads += other.payloads;
+        cache_hits += other.cache_hits;
+        cache_misses += other.cache_misses;
+        cache_evictions += other.cache_evictions;
+    }
+
+    double dedupRatio() const
+    {
+        return points_before_dedup > 0.0 ? points_after_dedup / points_before_dedup : 1.0;
+    }
+
+    static osg::Stats* getStats(const osgDB::Options* options)
+    {
+        return options ? dynamic_cast<osg::Stats*>(const_cast<osg::Referenced*>(options->getUserData())) : NULL;
+    }
+
+    void publishRead(const osgDB::Options* options) const
+    {
+        OSG_INFO << "drc read: " << input_bytes << " bytes, " << vertices << " vertices, "
+            << faces << " faces, decode " << decode_ms << " ms, conversion "
+            << conversion_ms << " ms, optimize " << optimize_ms << " ms, kdtree "
+            << kdtree_ms << " ms" << std::endl;
+
+        osg::Stats* stats = getStats(options);
+        if (!stats) return;
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(stats->getMutex());
+        unsigned int frame = stats->getLatestFrameNumber();
+        publish(stats, frame, "drc read count", 1.0, true);
+        publish(stats, frame, "drc read decode ms", decode_ms);
+        publish(stats, frame, "drc read conversion ms", conversion_ms);
+        publish(stats, frame, "drc read optimize ms", optimize_ms);
+        publish(stats, frame, "drc read kdtree ms", kdtree_ms);
+        publish(stats, frame, "drc read input bytes", input_bytes);
+        publish(stats, frame, "drc read vertices", vertices);
+        publish(stats, frame, "drc read faces", faces);
+        publish(stats, frame, "drc read payloads", payloads);
+        publish(stats, frame, "drc read cache hits", cache_hits);
+        publish(stats, frame, "drc read cache misses", cache_misses);
+        publish(stats, frame, "drc read cache evictions", cache_evictions);
+    }
+
+    void publishWrite(const osgDB::Options* options) const
+    {
+        OSG_INFO << "drc write: " << output_bytes << " bytes, " << vertices << " vertices, "
+            << faces << " faces, flatten " << flatten_ms << " ms, encode "
+            << encode_ms << " ms, dedup ratio " << dedupRatio() << std::endl;
+
+        osg::Stats* stats = getStats(options);
+        if (!stats) return;
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(stats->getMutex());
+        unsigned int frame = stats->getLatestFrameNumber();
+        publish(stats, frame, "drc write count", 1.0, true);
+        publish(stats, frame, "drc write flatten ms", flatten_ms);
+        publish(stats, frame, "drc write encode ms", encode_ms);
+        publish(stats, frame, "drc write output bytes", output_bytes);
+        publish(stats, frame, "drc write vertices", vertices);
+        publish(stats, frame, "drc write faces", faces);
+        publish(stats, frame, "drc write payloads", payloads);
+        stats->setAttributeNoMutex(frame, "drc write dedup ratio", dedupRatio());
+    }
+
+private:
+
+    //value of this call plus the frame total, caller holds the stats mutex
+    static void publish(osg::Stats* stats, unsigned int frame, const std::string& name,
+        double value, bool total_only = false)
+    {
+        if (!total_only)
+        {
+            stats->setAttributeNoMutex(frame, name, value);
+        }
+
+        std::string total_name = total_only ? name : name + " total";
+        double total = 0.0;
+        stats->getAttributeNoMutex(frame, total_name, total);
+        stats->setAttributeNoMutex(frame, total_name, total + value);
+    }
+};
+
+#endif
@@ -1,6 +1,26 @@
 
+#include <osg/BoundingBox>
+#include <osg/PrimitiveSet>
 #include <osg/TriangleIndexFunctor>
 
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <map>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OSGDB_DRC_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#include "DracoContainer.h"
+
 //TriangleCollector
 struct TriangleCollector
 {
@@ -14,40 +34,525 @@ struct TriangleCollector
     std::vector<unsigned int> triangles;
 };
 
+//PrimitiveCollector
+//point or line indices of every primitive set, line strips and loops are
+//split into segments. triangles are left to TriangleCollector
+class PrimitiveCollector
+    : public osg::PrimitiveIndexFunctor
+{
+public:
+    //mode GL_POINTS or GL_LINES
+    PrimitiveCollector(GLenum mode = GL_LINES)
+        : m_mode(mode)
+        , m_begin_mode(0)
+    {
+    }
+
+    virtual void setVertexArray(unsigned int, const osg::Vec2*) {}
+    virtual void setVertexArray(unsigned int, const osg::Vec3*) {}
+    virtual void setVertexArray(unsigned int, const osg::Vec4*) {}
+    virtual void setVertexArray(unsigned int, const osg::Vec2d*) {}
+    virtual void setVertexArray(unsigned int, const osg::Vec3d*) {}
+    virtual void setVertexArray(unsigned int, const osg::Vec4d*) {}
+
+    virtual void drawArrays(GLenum mode, GLint first, GLsizei count)
+    {
+        if (!wanted(mode)) return;
+        m_scratch.resize(count);
+        for (GLsizei i = 0; i < count; i++) m_scratch[i] = static_cast<unsigned int>(first + i);
+        add(mode, m_scratch.data(), count);
+    }
+
+    virtual void drawElements(GLenum mode, GLsizei count, const GLubyte* indices) { addElements(mode, count, indices); }
+    virtual void drawElements(GLenum mode, GLsizei count, const GLushort* indices) { addElements(mode, count, indices); }
+    virtual void drawElements(GLenum mode, GLsizei count, const GLuint* indices) { addElements(mode, count, indices); }
+
+    virtual void begin(GLenum mode)
+    {
+        m_begin_mode = mode;
+        m_begin_indices.clear();
+    }
+    virtual void vertex(unsigned int index) { if (wanted(m_begin_mode)) m_begin_indices.push_back(index); }
+    virtual void end()
+    {
+        if (!m_begin_indices.empty()) add(m_begin_mode, m_begin_indices.data(), m_begin_indices.size());
+    }
+
+    std::vector<unsigned int> indices;
+
+private:
+
+    //the triangle sets of a mesh pass through here too, skip them before
+    //their indices are copied
+    bool wanted(GLenum mode) const
+    {
+        if (m_mode == GL_POINTS) return mode == GL_POINTS;
+        return mode == GL_LINES || mode == GL_LINE_STRIP || mode == GL_LINE_LOOP;
+    }
+
+    template<typename T>
+    void addElements(GLenum mode, GLsizei count, const T* elements)
+    {
+        if (!wanted(mode)) return;
+        m_scratch.assign(elements, elements + count);
+        add(mode, m_scratch.data(), count);
+    }
+
+    void add(GLenum mode, const unsigned int* index, size_t count)
+    {
+        if (m_mode == GL_POINTS)
+        {
+            if (mode == GL_POINTS) indices.insert(indices.end(), index, index + count);
+            return;
+        }
+
+        switch (mode)
+        {
+        case GL_LINES:
+            for (size_t i = 0; i + 1 < count; i += 2) addLine(index[i], index[i + 1]);
+            break;
+        case GL_LINE_STRIP:
+            for (size_t i = 0; i + 1 < count; i++) addLine(index[i], index[i + 1]);
+            break;
+        case GL_LINE_LOOP:
+            for (size_t i = 0; i + 1 < count; i++) addLine(index[i], index[i + 1]);
+            if (count > 2) addLine(index[count - 1], index[0]);
+            break;
+        default:
+            break;
+        }
+    }
+
+    void addLine(unsigned int i1, unsigned int i2)
+    {
+        if (i1 == i2) return;
+        indices.push_back(i1);
+        indices.push_back(i2);
+    }
+
+    GLenum m_mode;
+    GLenum m_begin_mode;
+    std::vector<unsigned int> m_begin_indices;
+    std::vector<unsigned int> m_scratch;
+};
+
 //GeometryData
 class GeometryData
 {
 public:
 
+    typedef std::map<unsigned int, osg::ref_ptr<osg::Vec2Array> > TexCoordMap;
+    typedef std::map<unsigned int, osg::ref_ptr<osg::Array> > AttribMap;
+
     GeometryData()
     {
         raw_vertex = new osg::Vec3Array();
-        raw_normal = new osg::Vec3Array();
-        //raw_color = new osg::Vec4Array();
-        raw_uv0 = new osg::Vec2Array();
+        raw_index = new osg::UIntArray();
     }
 
     void resize(rsize_t s)
     {
         raw_vertex->resize(s);
-        raw_normal->resize(s);
-        //raw_color->resize(s);
-        raw_uv0->resize(s);
+        if (raw_normal.valid()) raw_normal->resize(s);
+        if (raw_color.valid()) raw_color->resize(s);
+        for (TexCoordMap::iterator itr = raw_uv.begin(); itr != raw_uv.end(); ++itr)
+        {
+            itr->second->resize(s);
+        }
+        for (AttribMap::iterator itr = raw_attrib.begin(); itr != raw_attrib.end(); ++itr)
+        {
+            itr->second->resizeArray(s);
+        }
     }
 
+    //which optional arrays exist, so equal data in different slots differs
+    std::vector<unsigned int> layout() const
+    {
+        std::vector<unsigned int> result;
+        result.push_back(raw_normal.valid() ? 1 : 0);
+        result.push_back(raw_color.valid() ? 1 : 0);
+        for (TexCoordMap::const_iterator itr = raw_uv.begin(); itr != raw_uv.end(); ++itr)
+        {
+            result.push_back(itr->first);
+        }
+        result.push_back(~0u);
+        for (AttribMap::const_iterator itr = raw_attrib.begin(); itr != raw_attrib.end(); ++itr)
+        {
+            result.push_back(itr->first);
+            result.push_back(itr->second->getDataSize());
+        }
+        return result;
+    }
+
+    //every array in layout order
+    std::vector<const osg::Array*> arrays() const
+    {
+        std::vector<const osg::Array*> result;
+        result.push_back(raw_vertex.get());
+        if (raw_normal.valid()) result.push_back(raw_normal.get());
+        if (raw_color.valid()) result.push_back(raw_color.get());
+        for (TexCoordMap::const_iterator itr = raw_uv.begin(); itr != raw_uv.end(); ++itr)
+        {
+            result.push_back(itr->second.get());
+        }
+        for (AttribMap::const_iterator itr = raw_attrib.begin(); itr != raw_attrib.end(); ++itr)
+        {
+            result.push_back(itr->second.get());
+        }
+        result.push_back(raw_index.get());
+        return result;
+    }
+
+    //the optional arrays below only exist when at least one flattened
+    //Geometry has them, Geometry without them fill in a neutral value
     osg::ref_ptr<osg::Vec3Array> raw_vertex = new osg::Vec3Array();
-    osg::ref_ptr<osg::Vec3Array> raw_normal = new osg::Vec3Array();
-    //osg::ref_ptr<osg::Vec4Array> raw_color = new osg::Vec4Array();
-    osg::ref_ptr<osg::Vec2Array> raw_uv0 = new osg::Vec2Array();
+    osg::ref_ptr<osg::Vec3Array> raw_normal;
+    osg::ref_ptr<osg::Vec4Array> raw_color;
+    //texture coordinates by unit
+    TexCoordMap raw_uv;
+    //generic vertex attributes by index, Float/Vec2/Vec3/Vec4Array
+    AttribMap raw_attrib;
+    //primitives indexing the arrays above, three indices per triangle, or
+    //two per line / one per point when flattened for those primitives
+    osg::ref_ptr<osg::UIntArray> raw_index = new osg::UIntArray();
+};
+
+//FNV-1a over the flattened arrays, used to find content identical geometry
+inline size_t hashGeometryData(const GeometryData& data)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    std::vector<unsigned int> layout = data.layout();
+    for (size_t i = 0; i < layout.size(); i++)
+    {
+        hash = (hash ^ layout[i]) * 1099511628211ULL;
+    }
+
+    std::vector<const osg::Array*> arrays = data.arrays();
+    for (size_t a = 0; a < arrays.size(); a++)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(arrays[a]->getDataPointer());
+        unsigned int size = arrays[a]->getTotalDataSize();
+        for (unsigned int i = 0; i < size; i++)
+        {
+            hash = (hash ^ bytes[i]) * 1099511628211ULL;
+        }
+        hash = (hash ^ size) * 1099511628211ULL;
+    }
+    return static_cast<size_t>(hash);
+}
+
+inline bool equalGeometryData(const GeometryData& lhs, const GeometryData& rhs)
+{
+    if (lhs.layout() != rhs.layout()) return false;
+
+    std::vector<const osg::Array*> a = lhs.arrays();
+    std::vector<const osg::Array*> b = rhs.arrays();
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if (a[i]->getTotalDataSize() != b[i]->getTotalDataSize()) return false;
+        if (a[i]->getTotalDataSize() > 0
+            && memcmp(a[i]->getDataPointer(), b[i]->getDataPointer(), a[i]->getTotalDataSize()) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+//copy of the given vertices of data with the same layout, without triangles
+inline GeometryData gatherGeometryData(const GeometryData& data, const unsigned int* indices, size_t count)
+{
+    GeometryData result;
+    if (data.raw_normal.valid()) result.raw_normal = new osg::Vec3Array();
+    if (data.raw_color.valid()) result.raw_color = new osg::Vec4Array();
+    for (GeometryData::TexCoordMap::const_iterator itr = data.raw_uv.begin(); itr != data.raw_uv.end(); ++itr)
+    {
+        result.raw_uv[itr->first] = new osg::Vec2Array();
+    }
+    for (GeometryData::AttribMap::const_iterator itr = data.raw_attrib.begin(); itr != data.raw_attrib.end(); ++itr)
+    {
+        result.raw_attrib[itr->first] = static_cast<osg::Array*>(itr->second->cloneType());
+    }
+    result.resize(count);
+
+    //arrays() lists both in the same order, the index array comes last
+    std::vector<const osg::Array*> src = data.arrays();
+    std::vector<const osg::Array*> dst = result.arrays();
+    for (size_t a = 0; a + 1 < src.size(); a++)
+    {
+        const size_t element_size = src[a]->getElementSize();
+        const char* from = static_cast<const char*>(src[a]->getDataPointer());
+        char* to = static_cast<char*>(const_cast<GLvoid*>(dst[a]->getDataPointer()));
+        if (!from || !to) continue;
+        for (size_t i = 0; i < count; i++)
+        {
+            memcpy(to + i * element_size, from + indices[i] * element_size, element_size);
+        }
+    }
+    return result;
+}
+
+//vertex clustering on a grid with cells per axis over the largest extent.
+//every cell keeps the attributes of its first vertex at the mean position,
+//triangles collapsing inside a cell are dropped
+inline GeometryData clusterGeometryData(const GeometryData& data, unsigned int cells)
+{
+    const osg::Vec3Array& vertices = *data.raw_vertex;
+    osg::BoundingBox bb;
+    for (size_t i = 0; i < vertices.size(); i++) bb.expandBy(vertices[i]);
+
+    cells = std::max(cells, 1u);
+    const float extent = std::max(bb.xMax() - bb.xMin(), std::max(bb.yMax() - bb.yMin(), bb.zMax() - bb.zMin()));
+    const float scale = extent > 0.0f ? cells / extent : 0.0f;
+
+    std::unordered_map<uint64_t, unsigned int> cell_cluster;
+    std::vector<unsigned int> cluster(vertices.size());
+    std::vector<unsigned int> first;
+    std::vector<osg::Vec3d> sums;
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        uint64_t key = 0;
+        for (int c = 0; c < 3; c++)
+        {
+            uint64_t cell = std::min<uint64_t>(static_cast<uint64_t>((vertices[i][c] - bb._min[c]) * scale), cells - 1);
+            key = key * cells + cell;
+        }
+
+        std::pair<std::unordered_map<uint64_t, unsigned int>::iterator, bool> inserted =
+            cell_cluster.insert(std::make_pair(key, static_cast<unsigned int>(first.size())));
+        if (inserted.second)
+        {
+            first.push_back(static_cast<unsigned int>(i));
+            sums.push_back(osg::Vec3d());
+        }
+        cluster[i] = inserted.first->second;
+        sums[cluster[i]] += osg::Vec3d(vertices[i]);
+    }
+
+    GeometryData result = gatherGeometryData(data, first.data(), first.size());
+    std::vector<unsigned int> counts(first.size(), 0);
+    for (size_t i = 0; i < cluster.size(); i++) counts[cluster[i]]++;
+    for (size_t c = 0; c < first.size(); c++)
+    {
+        (*result.raw_vertex)[c] = osg::Vec3(sums[c] / static_cast<double>(counts[c]));
+    }
+
+    const osg::UIntArray& index = *data.raw_index;
+    for (size_t i = 0; i + 2 < index.size(); i += 3)
+    {
+        unsigned int a = cluster[index[i]];
+        unsigned int b = cluster[index[i + 1]];
+        unsigned int c = cluster[index[i + 2]];
+        if (a == b || a == c || b == c) continue;
+        result.raw_index->push_back(a);
+        result.raw_index->push_back(b);
+        result.raw_index->push_back(c);
+    }
+    return result;
+}
+
+//PointOctree
+//splits points into octants until no node holds more than max_points. nodes
+//are stored parents first, a leaf owns m_order[begin, end)
+class PointOctree
+{
+public:
+
+    struct Node
+    {
+        int parent;
+        osg::BoundingBox bounds;    //tight bounds of the points below
+        size_t begin;
+        size_t end;
+        bool leaf;
+    };
+
+    void build(const osg::Vec3Array& points, size_t max_points, unsigned int max_depth = 21)
+    {
+        m_nodes.clear();
+        m_order.resize(points.size());
+        for (size_t i = 0; i < m_order.size(); i++) m_order[i] = static_cast<unsigned int>(i);
+        m_scratch.resize(points.size());
+        if (!points.empty()) split(points, -1, 0, points.size(), std::max<size_t>(max_points, 1), max_depth);
+    }
+
+    std::vector<Node> m_nodes;
+    std::vector<unsigned int> m_order;
+
+private:
+
+    void split(const osg::Vec3Array& points, int parent, size_t begin, size_t end,
+        size_t max_points, unsigned int depth)
+    {
+        Node node;
+        node.parent = parent;
+        node.begin = begin;
+        node.end = end;
+        for (size_t i = begin; i < end; i++) node.bounds.expandBy(points[m_order[i]]);
+
+        //identical points cannot be split any further
+        node.leaf = end - begin <= max_points || depth == 0
+            || (node.bounds.xMin() == node.bounds.xMax() && node.bounds.yMin() == node.bounds.yMax()
+                && node.bounds.zMin() == node.bounds.zMax());
+
+        const int index = static_cast<int>(m_nodes.size());
+        m_nodes.push_back(node);
+        if (node.leaf) return;
+
+        //counting sort by octant around the center
+        const osg::Vec3 center = node.bounds.center();
+        size_t counts[8] = { 0 };
+        for (size_t i = begin; i < end; i++) counts[octant(points[m_order[i]], center)]++;
+
+        size_t starts[9] = { begin };
+        for (int o = 0; o < 8; o++) starts[o + 1] = starts[o] + counts[o];
+
+        size_t fill[8];
+        std::copy(starts, starts + 8, fill);
+        for (size_t i = begin; i < end; i++) m_scratch[fill[octant(points[m_order[i]], center)]++] = m_order[i];
+        std::copy(m_scratch.begin() + begin, m_scratch.begin() + end, m_order.begin() + begin);
+
+        for (int o = 0; o < 8; o++)
+        {
+            if (counts[o] > 0) split(points, index, starts[o], starts[o + 1], max_points, depth - 1);
+        }
+    }
+
+    static int octant(const osg::Vec3& p, const osg::Vec3& center)
+    {
+        return (p.x() > center.x() ? 1 : 0) | (p.y() > center.y() ? 2 : 0) | (p.z() > center.z() ? 4 : 0);
+    }
+
+    std::vector<unsigned int> m_scratch;
+};
+
+//read element i of an osg array as n floats. integer data is scaled to
+//[0,1] / [-1,1] when normalize is set, missing components get 0 (w = 1)
+typedef void (*ArrayElementReader)(const osg::Array& array, size_t i, bool normalize, float* out, unsigned int n);
+
+template<typename T>
+void readArrayElement(const osg::Array& array, size_t i, bool normalize, float* out, unsigned int n)
+{
+    const unsigned int size = array.getDataSize();
+    const T* src = static_cast<const T*>(array.getDataPointer()) + i * size;
+    const float scale = (normalize && std::numeric_limits<T>::is_integer)
+        ? 1.0f / static_cast<float>(std::numeric_limits<T>::max()) : 1.0f;
+    const unsigned int m = std::min(size, n);
+    for (unsigned int c = 0; c < m; c++) out[c] = static_cast<float>(src[c]) * scale;
+    for (unsigned int c = m; c < n; c++) out[c] = (c == 3) ? 1.0f : 0.0f;
+}
+
+//NULL for data types that cannot be read
+inline ArrayElementReader arrayElementReader(const osg::Array* array)
+{
+    if (!array) return NULL;
+    switch (array->getDataType())
+    {
+    case GL_BYTE: return &readArrayElement<GLbyte>;
+    case GL_UNSIGNED_BYTE: return &readArrayElement<GLubyte>;
+    case GL_SHORT: return &readArrayElement<GLshort>;
+    case GL_UNSIGNED_SHORT: return &readArrayElement<GLushort>;
+    case GL_INT: return &readArrayElement<GLint>;
+    case GL_UNSIGNED_INT: return &readArrayElement<GLuint>;
+    case GL_FLOAT: return &readArrayElement<GLfloat>;
+    case GL_DOUBLE: return &readArrayElement<GLdouble>;
+    default: return NULL;
+    }
+}
+
+//float osg array with 1 to 4 components
+inline osg::Array* createFloatArray(unsigned int components)
+{
+    switch (components)
+    {
+    case 1: return new osg::FloatArray();
+    case 2: return new osg::Vec2Array();
+    case 3: return new osg::Vec3Array();
+    default: return new osg::Vec4Array();
+    }
+}
+
+//TransformKernel
+//v * matrix like osg::Vec3f * osg::Matrixd. for affine double matrices the
+//rows are kept in SSE2 registers and every output is computed with the same
+//operations in the same order as osg, so the result is bit identical
+class TransformKernel
+{
+public:
+    TransformKernel(const osg::Matrix& matrix)
+        : m_matrix(matrix)
+        , m_simd(sizeof(osg::Matrix::value_type) == sizeof(double)
+            && matrix(0, 3) == 0.0 && matrix(1, 3) == 0.0 && matrix(2, 3) == 0.0 && matrix(3, 3) == 1.0)
+    {
+#ifdef OSGDB_DRC_SSE2
+        for (int r = 0; r < 4; r++)
+        {
+            m_xy[r] = _mm_set_pd(matrix(r, 1), matrix(r, 0));
+            m_z[r] = _mm_set_sd(matrix(r, 2));
+        }
+#endif
+    }
+
+    osg::Vec3f transform(const osg::Vec3f& v) const
+    {
+#ifdef OSGDB_DRC_SSE2
+        if (m_simd)
+        {
+            const __m128d x = _mm_set1_pd(v.x());
+            const __m128d y = _mm_set1_pd(v.y());
+            const __m128d z = _mm_set1_pd(v.z());
+            __m128d xy = _mm_add_pd(_mm_add_pd(_mm_add_pd(
+                _mm_mul_pd(m_xy[0], x), _mm_mul_pd(m_xy[1], y)), _mm_mul_pd(m_xy[2], z)), m_xy[3]);
+            __m128d zz = _mm_add_sd(_mm_add_sd(_mm_add_sd(
+                _mm_mul_sd(m_z[0], x), _mm_mul_sd(m_z[1], y)), _mm_mul_sd(m_z[2], z)), m_z[3]);
+
+            double out[2];
+            _mm_storeu_pd(out, xy);
+            return osg::Vec3f(static_cast<float>(out[0]), static_cast<float>(out[1]),
+                static_cast<float>(_mm_cvtsd_f64(zz)));
+        }
+#endif
+        return v * m_matrix;
+    }
+
+private:
+
+    osg::Matrix m_matrix;
+    bool m_simd;
+#ifdef OSGDB_DRC_SSE2
+    __m128d m_xy[4];
+    __m128d m_z[4];
+#endif
+};
+
+//GeometryInstance
+struct GeometryInstance
+{
+    osg::Geometry* geometry;
+    osg::Matrix matrix;
 };
 
 //flat
+//merges every Geometry into one indexed GeometryData. each source vertex is
+//copied once and the primitives index it, with all_vertices every vertex is
+//kept (point clouds), otherwise only the ones used by a primitive. the
+//primitive is GL_TRIANGLES by default, GL_LINES or GL_POINTS collect those
+//primitive sets instead.
+//a first pass collects the primitives of every Geometry and counts its
+//output so the arrays are sized once, the fill pass then writes them in
+//place from the kept lists without collecting the primitives again. the
+//remap scratch buffer is pooled per thread. with several threads both
+//passes run per Geometry in parallel.
 class GeometryFlat
     :public osg::NodeVisitor
 {
 public:
-    GeometryFlat()
+    //num_threads 0 uses every core
+    GeometryFlat(bool all_vertices = false, unsigned int num_threads = 1, GLenum primitive = GL_TRIANGLES)
         :osg::NodeVisitor(osg::NodeVisitor::TraversalMode::TRAVERSE_ALL_CHILDREN)
+        , m_all_vertices(all_vertices)
+        , m_primitive(primitive)
+        , m_num_threads(num_threads > 0 ? num_threads : std::max(1u, std::thread::hardware_concurrency()))
     {
     }
     virtual ~GeometryFlat() {}
@@ -68,7 +573,10 @@ public:
             osg::Geometry* geom = dynamic_cast<osg::Geometry*>(geode.getChild(i));
             if (geom)
             {
-                processGeomatry(*geom, m_current_matrix);
+                GeometryInstance instance;
+                instance.geometry = geom;
+                instance.matrix = m_current_matrix;
+                m_instances.push_back(instance);
             }
         }
 
@@ -77,94 +585,597 @@ public:
 
     GeometryData m_geomtry_data;
 
-private:
+    //every Geometry under the node with its world matrix
+    void flatten(osg::Node& node)
+    {
+        m_instances.clear();
+        m_current_matrix.makeIdentity();
+        node.accept(*this);
+        flatten(m_instances);
+        m_instances.clear();
+    }
 
-    osg::Matrix m_current_matrix;
+    //count pass, one resize of every array, fill pass
+    void flatten(const std::vector<GeometryInstance>& instances)
+    {
+        std::vector<GeometryCount> counts(instances.size());
+        forEachInstance(instances.size(), [&](size_t i, FlatScratch& scratch)
+        {
+            countGeometry(*instances[i].geometry, counts[i], scratch);
+        });
+
+        //slice of every Geometry in the output arrays
+        std::vector<size_t> vertex_offsets(instances.size());
+        std::vector<size_t> index_offsets(instances.size());
+        size_t num_vertices = m_geomtry_data.raw_vertex->size();
+        size_t num_indices = m_geomtry_data.raw_index->size();
+        for (size_t i = 0; i < instances.size(); i++)
+        {
+            vertex_offsets[i] = num_vertices;
+            index_offsets[i] = num_indices;
+            num_vertices += counts[i].vertices;
+            num_indices += counts[i].indices.size();
+        }
+
+        addChannels(instances);
+        m_geomtry_data.resize(num_vertices);
+        m_geomtry_data.raw_index->resize(num_indices);
+
+        forEachInstance(instances.size(), [&](size_t i, FlatScratch& scratch)
+        {
+            fillGeometry(*instances[i].geometry, instances[i].matrix,
+                vertex_offsets[i], index_offsets[i], counts[i], scratch);
+        });
+    }
 
     //ϲgeometryľ
     void processGeomatry(osg::Geometry& geometry, osg::Matrix in_matrix)
     {
-        //triangulate
-        osg::TriangleIndexFunctor< TriangleCollector > tif;
-        (&geometry)->accept(tif);
+        GeometryInstance instance;
+        instance.geometry = &geometry;
+        instance.matrix = in_matrix;
+        flatten(std::vector<GeometryInstance>(1, instance));
+    }
+
+private:
+
+    //output of one Geometry kept from the count pass. indices number the
+    //output vertices from 0, used is the source vertex of each of them
+    struct GeometryCount
+    {
+        GeometryCount() : vertices(0) {}
+
+        size_t vertices;
+        std::vector<unsigned int> indices;
+        std::vector<unsigned int> used;
+    };
+
+    //one optional per vertex array of a Geometry and where it goes,
+    //without a source the fallback value is written
+    struct FlatChannel
+    {
+        const osg::Array* source;
+        bool overall;       //element 0 for every vertex
+        ArrayElementReader read;
+        bool normalize;
+        float* target;
+        unsigned int components;
+        const float* fallback;
+    };
 
-        //vertex normal color uv0
+    //pooled buffers of one thread
+    struct FlatScratch
+    {
+        std::vector<unsigned int> remap;
+        std::vector<FlatChannel> channels;
+    };
+
+    static const float* whiteColor() { static const float value[4] = { 1.0f, 1.0f, 1.0f, 1.0f }; return value; }
+    static const float* zeroValue() { static const float value[4] = { 0.0f, 0.0f, 0.0f, 1.0f }; return value; }
+    static const float* upNormal() { static const float value[3] = { 0.0f, 0.0f, 1.0f }; return value; }
+
+    //whether an array gives every vertex a value, by its binding. overall
+    //arrays repeat their first element. arrays set without a binding count
+    //as per vertex when large enough, per primitive set ones are skipped
+    static bool perVertexSource(const osg::Array* array, size_t num_vertices, bool& overall)
+    {
+        overall = false;
+        if (!array || array->getNumElements() == 0) return false;
+        switch (array->getBinding())
+        {
+        case osg::Array::BIND_OVERALL:
+            overall = true;
+            return true;
+        case osg::Array::BIND_PER_VERTEX:
+            return array->getNumElements() >= num_vertices;
+        case osg::Array::BIND_UNDEFINED:
+            if (array->getNumElements() >= num_vertices) return true;
+            overall = array->getNumElements() == 1;
+            return overall;
+        default:
+            return false;
+        }
+    }
+
+    //normals are transformed, so only Vec3Array sources are used
+    static const osg::Vec3Array* normalArray(osg::Geometry& geometry, size_t num_vertices, bool& overall)
+    {
+        const osg::Vec3Array* normal = dynamic_cast<const osg::Vec3Array*>(geometry.getNormalArray());
+        return perVertexSource(normal, num_vertices, overall) ? normal : NULL;
+    }
+
+    //an array the fill can read for every vertex, NULL otherwise
+    static const osg::Array* channelSource(const osg::Array* array, size_t num_vertices, bool& overall)
+    {
+        if (!perVertexSource(array, num_vertices, overall) || !arrayElementReader(array)) return NULL;
+        return array;
+    }
+
+    static const osg::Array* channelSource(const osg::Array* array, size_t num_vertices)
+    {
+        bool overall;
+        return channelSource(array, num_vertices, overall);
+    }
+
+    //fill the first size elements of a new output array with the fallback
+    static void fillFallback(osg::Array& array, size_t size, const float* fallback)
+    {
+        array.resizeArray(static_cast<unsigned int>(size));
+        if (size == 0) return;
+        const unsigned int components = array.getDataSize();
+        float* values = static_cast<float*>(const_cast<GLvoid*>(array.getDataPointer()));
+        for (size_t i = 0; i < size; i++)
+        {
+            memcpy(values + i * components, fallback, components * sizeof(float));
+        }
+    }
+
+    //create the optional output arrays any of the Geometry has a source for.
+    //vertices flattened by an earlier call get the fallback value
+    void addChannels(const std::vector<GeometryInstance>& instances)
+    {
+        GeometryData& data = m_geomtry_data;
+        const size_t existing = data.raw_vertex->size();
+        for (size_t i = 0; i < instances.size(); i++)
+        {
+            osg::Geometry& geometry = *instances[i].geometry;
+            osg::Vec3Array* vertex = vertexArray(geometry);
+            if (!vertex) continue;
+            const size_t num_vertices = vertex->size();
+
+            bool overall;
+            if (!data.raw_normal.valid() && normalArray(geometry, num_vertices, overall))
+            {
+                data.raw_normal = new osg::Vec3Array();
+                fillFallback(*data.raw_normal, existing, upNormal());
+            }
+
+            if (!data.raw_color.valid() && channelSource(geometry.getColorArray(), num_vertices))
+            {
+                data.raw_color = new osg::Vec4Array();
+                fillFallback(*data.raw_color, existing, whiteColor());
+            }
+
+            for (unsigned int unit = 0; unit < geometry.getNumTexCoordArrays(); unit++)
+            {
+                if (data.raw_uv.count(unit) || !channelSource(geometry.getTexCoordArray(unit), num_vertices)) continue;
+                osg::ref_ptr<osg::Vec2Array> uv = new osg::Vec2Array();
+                fillFallback(*uv, existing, zeroValue());
+                data.raw_uv[unit] = uv;
+            }
+
+            for (unsigned int index = 0; index < geometry.getNumVertexAttribArrays(); index++)
+            {
+                const osg::Array* source = channelSource(geometry.getVertexAttribArray(index), num_vertices);
+                if (data.raw_attrib.count(index) || !source) continue;
+                osg::ref_ptr<osg::Array> attrib = createFloatArray(std::min(source->getDataSize(), 4u));
+                fillFallback(*attrib, existing, zeroValue());
+                data.raw_attrib[index] = attrib;
+            }
+        }
+    }
+
+    //the channels of one Geometry, in the same order for every Geometry
+    void collectChannels(osg::Geometry& geometry, size_t num_vertices, std::vector<FlatChannel>& channels)
+    {
+        channels.clear();
+        GeometryData& data = m_geomtry_data;
+        if (data.raw_color.valid())
+        {
+            //integer colors are always normalized, like glColorPointer
+            bool overall;
+            const osg::Array* source = channelSource(geometry.getColorArray(), num_vertices, overall);
+            addChannel(source, overall, true, *data.raw_color, whiteColor(), channels);
+        }
+        for (GeometryData::TexCoordMap::iterator itr = data.raw_uv.begin(); itr != data.raw_uv.end(); ++itr)
+        {
+            bool overall;
+            const osg::Array* source = channelSource(geometry.getTexCoordArray(itr->first), num_vertices, overall);
+            addChannel(source, overall, source && source->getNormalize(), *itr->second, zeroValue(), channels);
+        }
+        for (GeometryData::AttribMap::iterator itr = data.raw_attrib.begin(); itr != data.raw_attrib.end(); ++itr)
+        {
+            bool overall;
+            const osg::Array* source = channelSource(geometry.getVertexAttribArray(itr->first), num_vertices, overall);
+            addChannel(source, overall, source && source->getNormalize(), *itr->second, zeroValue(), channels);
+        }
+    }
+
+    static void addChannel(const osg::Array* source, bool overall, bool normalize, osg::Array& target,
+        const float* fallback, std::vector<FlatChannel>& channels)
+    {
+        FlatChannel channel;
+        channel.source = source;
+        channel.overall = overall;
+        channel.read = arrayElementReader(source);
+        channel.normalize = normalize;
+        channel.target = static_cast<float*>(const_cast<GLvoid*>(target.getDataPointer()));
+        channel.components = target.getDataSize();
+        channel.fallback = fallback;
+        channels.push_back(channel);
+    }
+
+    //run func(i, scratch) for every i in [0, count), on the calling thread
+    //or spread over the worker threads
+    template<class Func>
+    void forEachInstance(size_t count, Func func)
+    {
+        const size_t num_threads = std::min<size_t>(m_num_threads, count);
+        if (m_scratch.size() < std::max<size_t>(num_threads, 1)) m_scratch.resize(std::max<size_t>(num_threads, 1));
+
+        if (num_threads <= 1)
+        {
+            for (size_t i = 0; i < count; i++) func(i, m_scratch[0]);
+            return;
+        }
+
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < num_threads; t++)
+        {
+            FlatScratch* scratch = &m_scratch[t];
+            threads.push_back(std::thread([&next, &func, count, scratch]()
+            {
+                for (size_t i = next++; i < count; i = next++) func(i, *scratch);
+            }));
+        }
+        for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+    }
+
+    static osg::Vec3Array* vertexArray(osg::Geometry& geometry)
+    {
         osg::Vec3Array* vertex = dynamic_cast<osg::Vec3Array*>(geometry.getVertexArray());
-        osg::Vec3Array* normal = dynamic_cast<osg::Vec3Array*>(geometry.getNormalArray());
-        osg::Vec4Array* color = dynamic_cast<osg::Vec4Array*>(geometry.getColorArray());
-        osg::Vec2Array* uv0 = dynamic_cast<osg::Vec2Array*>(geometry.getTexCoordArray(0));
-        //osg::ref_ptr<osg::Vec3Array> raw_vertex = new osg::Vec3Array();
-        //osg::ref_ptr<osg::Vec3Array> raw_normal = new osg::Vec3Array();
-        //osg::ref_ptr<osg::Vec4Array> raw_color = new osg::Vec4Array();
-        //osg::ref_ptr<osg::Vec2Array> raw_uv0 = new osg::Vec2Array();
+        return (vertex && !vertex->empty()) ? vertex : NULL;
+    }
+
+    //primitives of the Geometry into count.indices, dropping the ones with
+    //missing vertices, and number the used vertices in first use order
+    void collectPrimitives(osg::Geometry& geometry, size_t num_vertices, GeometryCount& count,
+        FlatScratch& scratch) const
+    {
+        //sized once, growing the kept lists costs more than collecting them.
+        //a Geometry without primitives of this mode, like a triangle mesh in
+        //the lines and points passes, costs no scratch and no lists
+        std::vector<unsigned int>& primitives = count.indices;
+        primitives.clear();
+        count.used.clear();
+        count.vertices = 0;
+        const size_t hint = primitiveIndexHint(geometry);
+        if (hint == 0) return;
+        primitives.reserve(hint);
+        count.used.reserve(std::min(num_vertices, hint));
+        if (m_primitive == GL_TRIANGLES)
+        {
+            osg::TriangleIndexFunctor< TriangleCollector > tif;
+            tif.triangles.swap(primitives);
+            (&geometry)->accept(tif);
+            tif.triangles.swap(primitives);
+        }
+        else
+        {
+            PrimitiveCollector pc(m_primitive);
+            pc.indices.swap(primitives);
+            (&geometry)->accept(pc);
+            pc.indices.swap(primitives);
+        }
+
+        const size_t size = m_primitive == GL_TRIANGLES ? 3 : (m_primitive == GL_LINES ? 2 : 1);
+        size_t valid = 0;
+        for (size_t i = 0; i + size <= primitives.size(); i += size)
+        {
+            bool inside = true;
+            for (size_t k = 0; k < size; k++) inside = inside && primitives[i + k] < num_vertices;
+            if (!inside) continue;
+            for (size_t k = 0; k < size; k++) primitives[valid++] = primitives[i + k];
+        }
+        primitives.resize(valid);
+
+        //source vertex to output vertex, ~0u for unused vertices. the indices
+        //are renumbered in place so the fill pass only adds the offset
+        std::vector<unsigned int>& remap = scratch.remap;
+        remap.assign(num_vertices, ~0u);
+        count.used.clear();
+        for (size_t i = 0; i < primitives.size(); i++)
+        {
+            unsigned int& out = remap[primitives[i]];
+            if (out == ~0u)
+            {
+                out = static_cast<unsigned int>(count.used.size());
+                count.used.push_back(primitives[i]);
+            }
+            primitives[i] = out;
+        }
+        count.vertices = count.used.size();
+    }
+
+    //indices the collected primitives of the Geometry take, exact for lists
+    //and an upper bound for strips, fans and loops
+    size_t primitiveIndexHint(const osg::Geometry& geometry) const
+    {
+        size_t hint = 0;
+        for (unsigned int i = 0; i < geometry.getNumPrimitiveSets(); i++)
+        {
+            const osg::PrimitiveSet* set = geometry.getPrimitiveSet(i);
+            const size_t n = set->getNumIndices();
+            switch (set->getMode())
+            {
+            case GL_POINTS: if (m_primitive == GL_POINTS) hint += n; break;
+            case GL_LINES: if (m_primitive == GL_LINES) hint += n; break;
+            case GL_LINE_STRIP:
+            case GL_LINE_LOOP: if (m_primitive == GL_LINES) hint += 2 * n; break;
+            case GL_TRIANGLES: if (m_primitive == GL_TRIANGLES) hint += n; break;
+            default: if (m_primitive == GL_TRIANGLES) hint += 3 * n; break;
+            }
+        }
+        return hint;
+    }
+
+    void countGeometry(osg::Geometry& geometry, GeometryCount& count, FlatScratch& scratch) const
+    {
+        osg::Vec3Array* vertex = vertexArray(geometry);
+        if (!vertex) return;
+
+        if (m_all_vertices)
+        {
+            count.vertices = vertex->size();
+            return;
+        }
+
+        collectPrimitives(geometry, vertex->size(), count, scratch);
+    }
+
+    //write one Geometry at the offsets reserved by the count pass, slices of
+    //different Geometry never overlap so this is safe from several threads.
+    //the lists kept in count are released once written
+    void fillGeometry(osg::Geometry& geometry, const osg::Matrix& in_matrix,
+        size_t vertex_offset, size_t index_offset, GeometryCount& count, FlatScratch& scratch)
+    {
+        //vertex and normal, the other arrays are channels
+        osg::Vec3Array* vertex = vertexArray(geometry);
+        if (!vertex || (!m_all_vertices && count.vertices == 0)) return;
+
+        //only per vertex arrays can follow the vertex indices
+        const size_t num_vertices = vertex->size();
+        bool normal_overall;
+        const osg::Vec3Array* normal = normalArray(geometry, num_vertices, normal_overall);
 
         //for normal correct
         osg::Matrix in_matrix_rs = in_matrix;
         in_matrix_rs.setTrans(0, 0, 0);
+        const TransformKernel point_kernel(in_matrix);
+        const TransformKernel normal_kernel(in_matrix_rs);
+
+        collectChannels(geometry, num_vertices, scratch.channels);
+        const std::vector<FlatChannel>& channels = scratch.channels;
 
-        //for
-        for (size_t i = 0; i < tif.triangles.size(); i += 3)
+        if (m_all_vertices)
         {
-            //vertex
-            if (vertex)
+            for (size_t i = 0; i < num_vertices; i++)
             {
-                m_geomtry_data.raw_vertex->push_back(vertex->at(tif.triangles[i + 0]) *in_matrix);
-                m_geomtry_data.raw_vertex->push_back(vertex->at(tif.triangles[i + 1]) *in_matrix);
-                m_geomtry_data.raw_vertex->push_back(vertex->at(tif.triangles[i + 2]) *in_matrix);
+                setVertex(vertex_offset + i, *vertex, normal, normal_overall, i, point_kernel, normal_kernel);
+                setChannels(vertex_offset + i, i, channels);
             }
+            return;
+        }
 
-#if 0
-            //color
-            if (color)
-            {
-                m_geomtry_data.raw_color->push_back(color->at(tif.triangles[i + 0]));
-                m_geomtry_data.raw_color->push_back(color->at(tif.triangles[i + 1]));
-                m_geomtry_data.raw_color->push_back(color->at(tif.triangles[i + 2]));
-            }
-            else
+        //used vertices in output order, the writes walk the arrays forward
+        const std::vector<unsigned int>& used = count.used;
+        for (size_t k = 0; k < used.size(); k++)
+        {
+            setVertex(vertex_offset + k, *vertex, normal, normal_overall, used[k], point_kernel, normal_kernel);
+            setChannels(vertex_offset + k, used[k], channels);
+        }
+
+        const std::vector<unsigned int>& indices = count.indices;
+        if (!indices.empty())
+        {
+            unsigned int* index = &(*m_geomtry_data.raw_index)[index_offset];
+            for (size_t i = 0; i < indices.size(); i++)
             {
-                m_geomtry_data.raw_color->push_back(osg::Vec4(1, 1, 1, 1));
-                m_geomtry_data.raw_color->push_back(osg::Vec4(1, 1, 1, 1));
-                m_geomtry_data.raw_color->push_back(osg::Vec4(1, 1, 1, 1));
+                index[i] = static_cast<unsigned int>(vertex_offset + indices[i]);
             }
-#endif
+        }
+
+        std::vector<unsigned int>().swap(count.indices);
+        std::vector<unsigned int>().swap(count.used);
+    }
+
+    //transform one source vertex into its output slot
+    void setVertex(size_t out, const osg::Vec3Array& vertex, const osg::Vec3Array* normal, bool normal_overall,
+        size_t i, const TransformKernel& point_kernel, const TransformKernel& normal_kernel)
+    {
+        (*m_geomtry_data.raw_vertex)[out] = point_kernel.transform(vertex[i]);
+
+        //normal, only when some Geometry has normals
+        osg::Vec3Array* out_normal = m_geomtry_data.raw_normal.get();
+        if (!out_normal) return;
+        if (normal)
+        {
+            osg::Vec3 n = normal_kernel.transform((*normal)[normal_overall ? 0 : i]);
+            n.normalize();
+            (*out_normal)[out] = n;
+        }
+        else
+        {
+            (*out_normal)[out] = osg::Vec3(0, 0, 1);
+        }
+    }
 
-            //normal
-            if (normal)
+    //copy the optional arrays of one source vertex into its output slot
+    static void setChannels(size_t out, size_t i, const std::vector<FlatChannel>& channels)
+    {
+        for (size_t c = 0; c < channels.size(); c++)
+        {
+            const FlatChannel& channel = channels[c];
+            float* target = channel.target + out * channel.components;
+            if (channel.source)
             {
-                osg::Vec3 n0 = normal->at(tif.triangles[i + 0]) *in_matrix_rs;
-                osg::Vec3 n1 = normal->at(tif.triangles[i + 1]) *in_matrix_rs;
-                osg::Vec3 n2 = normal->at(tif.triangles[i + 2]) *in_matrix_rs;
-                n0.normalize();
-                n1.normalize();
-                n2.normalize();
-
-                m_geomtry_data.raw_normal->push_back(n0);
-                m_geomtry_data.raw_normal->push_back(n1);
-                m_geomtry_data.raw_normal->push_back(n2);
+                channel.read(*channel.source, channel.overall ? 0 : i, channel.normalize, target, channel.components);
             }
             else
             {
-                m_geomtry_data.raw_normal->push_back(osg::Vec3(0, 0, 1));
-                m_geomtry_data.raw_normal->push_back(osg::Vec3(0, 0, 1));
-                m_geomtry_data.raw_normal->push_back(osg::Vec3(0, 0, 1));
+                memcpy(target, channel.fallback, channel.components * sizeof(float));
             }
+        }
+    }
+
+    bool m_all_vertices;
+    GLenum m_primitive;
+    unsigned int m_num_threads;
+    osg::Matrix m_current_matrix;
+    std::vector<GeometryInstance> m_instances;
+
+    //scratch reused across Geometry, one per thread
+    std::vector<FlatScratch> m_scratch;
+};
 
-            //uv0
-            if (uv0)
+//collect
+//every Geometry under the node with its accumulated world matrix, a Geometry
+//reached through several paths is listed once per path
+class GeometryCollector
+    :public osg::NodeVisitor
+{
+public:
+    GeometryCollector()
+        :osg::NodeVisitor(osg::NodeVisitor::TraversalMode::TRAVERSE_ALL_CHILDREN)
+    {
+    }
+    virtual ~GeometryCollector() {}
+
+    virtual void apply(osg::Transform& transform)
+    {
+        osg::Matrix m = m_current_matrix;
+        transform.computeLocalToWorldMatrix(m_current_matrix, 0);
+        traverse(transform);
+        m_current_matrix = m;
+    }
+
+    virtual void apply(osg::Geode& geode)
+    {
+        unsigned int chaild_num = geode.getNumDrawables();
+        for (unsigned int i = 0; i < chaild_num; i++)
+        {
+            osg::Geometry* geom = dynamic_cast<osg::Geometry*>(geode.getDrawable(i));
+            if (geom)
             {
-                m_geomtry_data.raw_uv0->push_back(uv0->at(tif.triangles[i + 0]));
-                m_geomtry_data.raw_uv0->push_back(uv0->at(tif.triangles[i + 1]));
-                m_geomtry_data.raw_uv0->push_back(uv0->at(tif.triangles[i + 2]));
+                GeometryInstance instance;
+                instance.geometry = geom;
+                instance.matrix = m_current_matrix;
+                m_instances.push_back(instance);
             }
-            else
+        }
+    }
+
+    std::vector<GeometryInstance> m_instances;
+
+private:
+
+    osg::Matrix m_current_matrix;
+};
+
+//StructureEntry
+struct StructureEntry
+{
+    int parent;
+    unsigned int type;
+    osg::Matrix matrix;
+    osg::Geometry* geometry;
+    osg::StateSet* stateset;
+    std::string name;
+};
+
+//structure
+//records Group / Transform / Geode / Geometry in traversal order with the
+//index of their parent, the local matrix of transforms and their StateSets
+class GeometryStructure
+    :public osg::NodeVisitor
+{
+public:
+    GeometryStructure()
+        :osg::NodeVisitor(osg::NodeVisitor::TraversalMode::TRAVERSE_ALL_CHILDREN)
+        , m_parent(-1)
+    {
+    }
+    virtual ~GeometryStructure() {}
+
+    virtual void apply(osg::Group& group)
+    {
+        push(group, DRACO_NODE_GROUP, osg::Matrix::identity());
+    }
+
+    virtual void apply(osg::Transform& transform)
+    {
+        osg::Matrix m;
+        transform.computeLocalToWorldMatrix(m, this);
+        push(transform, DRACO_NODE_MATRIX_TRANSFORM, m);
+    }
+
+    virtual void apply(osg::Geode& geode)
+    {
+        int index = add(geode, DRACO_NODE_GEODE, osg::Matrix::identity());
+
+        unsigned int chaild_num = geode.getNumDrawables();
+        for (unsigned int i = 0; i < chaild_num; i++)
+        {
+            osg::Geometry* geom = dynamic_cast<osg::Geometry*>(geode.getDrawable(i));
+            if (geom)
             {
-                m_geomtry_data.raw_uv0->push_back(osg::Vec2(0, 0));
-                m_geomtry_data.raw_uv0->push_back(osg::Vec2(0, 0));
-                m_geomtry_data.raw_uv0->push_back(osg::Vec2(0, 0));
+                StructureEntry entry;
+                entry.parent = index;
+                entry.type = DRACO_NODE_GEOMETRY;
+                entry.geometry = geom;
+                entry.stateset = geom->getStateSet();
+                entry.name = geom->getName();
+                m_entries.push_back(entry);
             }
         }
     }
 
+    std::vector<StructureEntry> m_entries;
+
+private:
+
+    int add(osg::Node& node, unsigned int type, const osg::Matrix& matrix)
+    {
+        StructureEntry entry;
+        entry.parent = m_parent;
+        entry.type = type;
+        entry.matrix = matrix;
+        entry.geometry = NULL;
+        entry.stateset = node.getStateSet();
+        entry.name = node.getName();
+        m_entries.push_back(entry);
+        return static_cast<int>(m_entries.size() - 1);
+    }
+
+    void push(osg::Group& group, unsigned int type, const osg::Matrix& matrix)
+    {
+        int parent = m_parent;
+        m_parent = add(group, type, matrix);
+        traverse(group);
+        m_parent = parent;
+    }
+
+    int m_parent;
 };
 
@@ -0,0 +1,167 @@
+#ifndef OSGDB_DRC_MAPPED_FILE_H
+#define OSGDB_DRC_MAPPED_FILE_H
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//MappedFile
+//read only view of a whole file. the file is memory mapped when possible so
+//the decoder reads straight from the page cache, otherwise it falls back to
+//reading the file into a heap buffer.
+class MappedFile
+{
+public:
+
+    MappedFile()
+        : m_data(NULL)
+        , m_size(0)
+        , m_mapped(false)
+#ifdef _WIN32
+        , m_file(INVALID_HANDLE_VALUE)
+        , m_mapping(NULL)
+#endif
+    {
+    }
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    bool open(const std::string& fileName)
+    {
+        close();
+        if (map(fileName)) return true;
+        return readToBuffer(fileName);
+    }
+
+    //release the mapping or buffer, data() is invalid afterwards
+    void close()
+    {
+#ifdef _WIN32
+        if (m_mapped) UnmapViewOfFile(m_data);
+        if (m_mapping) CloseHandle(m_mapping);
+        if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+        m_mapping = NULL;
+        m_file = INVALID_HANDLE_VALUE;
+#else
+        if (m_mapped) munmap(const_cast<char*>(m_data), m_size);
+#endif
+        std::vector<char>().swap(m_buffer);
+        m_data = NULL;
+        m_size = 0;
+        m_mapped = false;
+    }
+
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool isMapped() const { return m_mapped; }
+
+private:
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    bool map(const std::string& fileName)
+    {
+#ifdef _WIN32
+        m_file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (m_file == INVALID_HANDLE_VALUE) return false;
+
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(m_file, &file_size) || file_size.QuadPart <= 0)
+        {
+            close();
+            return false;
+        }
+
+        m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!m_mapping)
+        {
+            close();
+            return false;
+        }
+
+        void* view = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!view)
+        {
+            close();
+            return false;
+        }
+
+        m_data = static_cast<const char*>(view);
+        m_size = static_cast<size_t>(file_size.QuadPart);
+        m_mapped = true;
+        return true;
+#else
+        int fd = ::open(fileName.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0)
+        {
+            ::close(fd);
+            return false;
+        }
+
+        void* view = mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        //the mapping keeps its own reference to the file
+        ::close(fd);
+        if (view == MAP_FAILED) return false;
+
+        madvise(view, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+
+        m_data = static_cast<const char*>(view);
+        m_size = static_cast<size_t>(st.st_size);
+        m_mapped = true;
+        return true;
+#endif
+    }
+
+    bool readToBuffer(const std::string& fileName)
+    {
+        std::ifstream input_file(fileName.c_str(), std::ios::binary);
+        if (!input_file) return false;
+
+        input_file.seekg(0, std::ios::end);
+        std::streamoff file_size = input_file.tellg();
+        input_file.seekg(0, std::ios::beg);
+        if (file_size <= 0) return true;
+
+        m_buffer.resize(static_cast<size_t>(file_size));
+        input_file.read(m_buffer.data(), file_size);
+        m_buffer.resize(static_cast<size_t>(input_file.gcount()));
+
+        m_data = m_buffer.data();
+        m_size = m_buffer.size();
+        return true;
+    }
+
+    const char* m_data;
+    size_t m_size;
+    bool m_mapped;
+    std::vector<char> m_buffer;
+#ifdef _WIN32
+    HANDLE m_file;
+    HANDLE m_mapping;
+#endif
+};
+
+#endif
@@ -1,24 +1,43 @@
 #include <osg/Notify>
 #include <osg/Geode>
 #include <osg/Geometry>
+#include <osg/KdTree>
+#include <osg/LOD>
+#include <osg/MatrixTransform>
+#include <osg/PagedLOD>
+#include <osg/Timer>
+#include <osg/Uniform>
 
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
 #include <osgDB/fstream>
 #include <osgDB/Registry>
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <math.h>
+#include <sstream>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <thread>
 
+#include <osgdb_drc/DracoMemoryStream.h>
+
+#include "DracoContainer.h"
+#include "DracoDecodeCache.h"
+#include "DracoStatistics.h"
 #include "GeometryUtil.h"
+#include "MappedFile.h"
+#include "VertexCacheOptimizer.h"
 
-#define private public   //for indices_map_
 #include "compression/encode.h"
 #include "core/cycle_timer.h"
 #include "io/mesh_io.h"
 #include "io/point_cloud_io.h"
-#undef private
 
 
 struct DracoOptions {
@@ -29,8 +48,12 @@ struct DracoOptions {
     int tex_coords_quantization_bits;
     int normals_quantization_bits;
     int compression_level;
-    std::string input;
-    std::string output;
+    int encode_speed;       // -1 = derived from compression_level
+    int decode_speed;       // -1 = derived from compression_level
+    int encoding_method;    // -1 = let draco choose
+    bool deduplicate;       // merge equal attribute values and points before encoding
+    int num_threads;        // worker threads, 0 = one per core
+    bool keep_point_order;  // point cloud whose order matters, e.g. line vertices
 };
 
 DracoOptions::DracoOptions()
@@ -38,101 +61,229 @@ DracoOptions::DracoOptions()
     pos_quantization_bits(14),
     tex_coords_quantization_bits(12),
     normals_quantization_bits(10),
-    compression_level(0) {}
-
-
+    compression_level(0),
+    encode_speed(-1),
+    decode_speed(-1),
+    encoding_method(-1),
+    deduplicate(false),
+    num_threads(1),
+    keep_point_order(false) {}
+
+
+//options are formatted into one string and emitted with a single notify call
+//so concurrent writers do not interleave their output. nothing is formatted
+//for every payload unless INFO is shown
 void PrintOptions(const draco::PointCloud &pc, const DracoOptions &options) {
-    printf("Encoder options:\n");
-    printf("  Compression level = %d\n", options.compression_level);
+    if (!osg::isNotifyEnabled(osg::INFO)) return;
+
+    std::ostringstream out;
+    out << "Encoder options:\n";
+    out << "  Compression level = " << options.compression_level << "\n";
+    if (options.encode_speed >= 0) {
+        out << "  Encode speed = " << options.encode_speed << "\n";
+    }
+    if (options.decode_speed >= 0) {
+        out << "  Decode speed = " << options.decode_speed << "\n";
+    }
+    if (options.encoding_method == draco::MESH_EDGEBREAKER_ENCODING) {
+        out << "  Method: edgebreaker\n";
+    }
+    else if (options.encoding_method == draco::MESH_SEQUENTIAL_ENCODING) {
+        out << "  Method: sequential\n";
+    }
     if (options.pos_quantization_bits <= 0) {
-        printf("  Positions: No quantization\n");
+        out << "  Positions: No quantization\n";
     }
     else {
-        printf("  Positions: Quantization = %d bits\n",
-            options.pos_quantization_bits);
+        out << "  Positions: Quantization = " << options.pos_quantization_bits << " bits\n";
     }
 
     if (pc.GetNamedAttributeId(draco::GeometryAttribute::TEX_COORD) >= 0) {
         if (options.tex_coords_quantization_bits <= 0) {
-            printf("  Texture coordinates: No quantization\n");
+            out << "  Texture coordinates: No quantization\n";
         }
         else {
-            printf("  Texture coordinates: Quantization = %d bits\n",
-                options.tex_coords_quantization_bits);
+            out << "  Texture coordinates: Quantization = "
+                << options.tex_coords_quantization_bits << " bits\n";
         }
     }
 
     if (pc.GetNamedAttributeId(draco::GeometryAttribute::NORMAL) >= 0) {
         if (options.normals_quantization_bits <= 0) {
-            printf("  Normals: No quantization\n");
+            out << "  Normals: No quantization\n";
         }
         else {
-            printf("  Normals: Quantization = %d bits\n",
-                options.normals_quantization_bits);
+            out << "  Normals: Quantization = " << options.normals_quantization_bits << " bits\n";
         }
     }
-    printf("\n");
+    OSG_INFO << out.str() << std::endl;
 }
 
-int EncodePointCloudToFile(const draco::PointCloud &pc,
+int EncodePointCloudToStream(const draco::PointCloud &pc,
     const draco::EncoderOptions &options,
-    const std::string &file) {
+    std::ostream &out_stream,
+    DracoStatistics &stats) {
     draco::CycleTimer timer;
     // Encode the geometry.
     draco::EncoderBuffer buffer;
     timer.Start();
     if (!draco::EncodePointCloudToBuffer(pc, options, &buffer)) {
-        printf("Failed to encode the point cloud.\n");
+        OSG_WARN << "Failed to encode the point cloud." << std::endl;
         return -1;
     }
     timer.Stop();
-    // Save the encoded geometry into a file.
-    std::ofstream out_file(file, std::ios::binary);
-    if (!out_file) {
-        printf("Failed to create the output file.\n");
+    // Save the encoded geometry into the stream.
+    out_stream.write(buffer.data(), buffer.size());
+    if (!out_stream) {
+        OSG_WARN << "Failed to write the encoded point cloud." << std::endl;
         return -1;
     }
-    out_file.write(buffer.data(), buffer.size());
-    printf("Encoded point cloud saved to %s (%" PRId64 " ms to encode)\n",
-        file.c_str(), timer.GetInMs());
-    printf("\nEncoded size = %zu bytes\n\n", buffer.size());
+    stats.encode_ms += timer.GetInMs();
+    stats.output_bytes += buffer.size();
     return 0;
 }
 
-int EncodeMeshToFile(const draco::Mesh &mesh,
+int EncodeMeshToStream(const draco::Mesh &mesh,
     const draco::EncoderOptions &options,
-    const std::string &file) {
+    std::ostream &out_stream,
+    DracoStatistics &stats) {
     draco::CycleTimer timer;
     // Encode the geometry.
     draco::EncoderBuffer buffer;
     timer.Start();
     if (!draco::EncodeMeshToBuffer(mesh, options, &buffer)) {
-        printf("Failed to encode the mesh.\n");
+        OSG_WARN << "Failed to encode the mesh." << std::endl;
         return -1;
     }
     timer.Stop();
-    // Save the encoded geometry into a file.
-    std::ofstream out_file(file, std::ios::binary);
-    if (!out_file) {
-        printf("Failed to create the output file.\n");
+    // Save the encoded geometry into the stream.
+    out_stream.write(buffer.data(), buffer.size());
+    if (!out_stream) {
+        OSG_WARN << "Failed to write the encoded mesh." << std::endl;
         return -1;
     }
-    out_file.write(buffer.data(), buffer.size());
-    printf("Encoded mesh saved to %s (%" PRId64 " ms to encode)\n", file.c_str(),
-        timer.GetInMs());
-    printf("\nEncoded size = %zu bytes\n\n", buffer.size());
+    stats.encode_ms += timer.GetInMs();
+    stats.output_bytes += buffer.size();
     return 0;
 }
 
+//read the rest of a stream into memory
+bool readStreamToBuffer(std::istream& fin, std::vector<char>& data)
+{
+    std::streampos begin = fin.tellg();
+    if (begin != std::streampos(-1))
+    {
+        fin.seekg(0, std::ios::end);
+        std::streampos end = fin.tellg();
+        fin.seekg(begin);
+        if (end != std::streampos(-1) && end > begin)
+        {
+            data.resize(static_cast<size_t>(end - begin));
+            fin.read(data.data(), data.size());
+            data.resize(static_cast<size_t>(fin.gcount()));
+            return !data.empty();
+        }
+    }
+
+    //not seekable, read in chunks
+    fin.clear();
+    char chunk[64 * 1024];
+    while (fin.read(chunk, sizeof(chunk)) || fin.gcount() > 0)
+    {
+        data.insert(data.end(), chunk, chunk + fin.gcount());
+    }
+    return !data.empty();
+}
+
+//attributes converted to osg arrays on read, positions always are
+enum DracoReadAttribute
+{
+    DRACO_READ_NORMAL = 1,
+    DRACO_READ_COLOR = 2,
+    DRACO_READ_TEXCOORD = 4,
+    DRACO_READ_GENERIC = 8,
+    DRACO_READ_ALL = 15
+};
+
+//comma separated draco_attributes list to DracoReadAttribute bits,
+//attributes is left unchanged when the list is invalid
+bool parseAttributeList(const std::string& value, unsigned int& attributes)
+{
+    if (value.empty()) return false;
+
+    unsigned int parsed = 0;
+    std::istringstream iss(value);
+    std::string name;
+    while (std::getline(iss, name, ','))
+    {
+        if (name == "position") continue;
+        else if (name == "normal") parsed |= DRACO_READ_NORMAL;
+        else if (name == "color") parsed |= DRACO_READ_COLOR;
+        else if (name == "texcoord") parsed |= DRACO_READ_TEXCOORD;
+        else if (name == "generic") parsed |= DRACO_READ_GENERIC;
+        else return false;
+    }
+    attributes = parsed;
+    return true;
+}
+
 struct DarocOptionsStruct
 {
     bool isPointCloud;
+    bool deindex;
+    bool structured;
+    bool instancing;
+    bool instanceHash;
+    bool compact;
+    bool compactPositions;
+    bool optimize;      //reorder decoded triangles and vertices for the vertex cache
+    bool kdTree;        //build an osg::KdTree per decoded Geometry
+    unsigned int attributes;    //DracoReadAttribute bits to convert
+    size_t cacheBytes;  //decode cache capacity, 0 = no cache
+    std::string cacheDir;   //osgb copies of decoded files, empty = none
+    int tilePoints;     //points per chunk of a tiled point cloud, 0 = not tiled
+    int lodLevels;      //coarse levels written below the full one
+    int lodSkip;        //finest levels of each LOD dropped on read for good
+    bool lodPaged;      //finer LOD levels read later by the database pager
+    std::string sourceFile;     //file the data was read from, empty for buffers
+    int subtreeRoot;    //container node read alone for a paged level, -1 = all
+    const osgDB::ReaderWriter::Options* readOptions;
+    DracoOptions encoder;
+    std::string error;  //first invalid option, empty if all are valid
 };
 
+//strict integer in [min_value, max_value]
+bool parseIntOption(const std::string& value, int min_value, int max_value, int& result)
+{
+    if (value.empty()) return false;
+    char* end = NULL;
+    long v = strtol(value.c_str(), &end, 10);
+    if (*end != '\0' || v < min_value || v > max_value) return false;
+    result = static_cast<int>(v);
+    return true;
+}
+
+//options are whitespace separated flags or key=value pairs
 DarocOptionsStruct parseOptions(const osgDB::ReaderWriter::Options* options)
 {
     DarocOptionsStruct localOptions;
     localOptions.isPointCloud = false;
+    localOptions.deindex = false;
+    localOptions.structured = false;
+    localOptions.instancing = false;
+    localOptions.instanceHash = false;
+    localOptions.compact = false;
+    localOptions.compactPositions = false;
+    localOptions.optimize = false;
+    localOptions.kdTree = false;
+    localOptions.attributes = DRACO_READ_ALL;
+    localOptions.cacheBytes = 0;
+    localOptions.tilePoints = 0;
+    localOptions.lodLevels = 0;
+    localOptions.lodSkip = 0;
+    localOptions.lodPaged = false;
+    localOptions.subtreeRoot = -1;
+    localOptions.readOptions = options;
 
     if (options != NULL)
     {
@@ -140,352 +291,727 @@ DarocOptionsStruct parseOptions(const osgDB::ReaderWriter::Options* options)
         std::string opt;
         while (iss >> opt)
         {
-            if (opt == "draco_point_cloud")
+            std::string key = opt;
+            std::string value;
+            std::string::size_type eq = opt.find('=');
+            if (eq != std::string::npos)
+            {
+                key = opt.substr(0, eq);
+                value = opt.substr(eq + 1);
+            }
+
+            DracoOptions& encoder = localOptions.encoder;
+            bool valid = true;
+            if (key == "draco_point_cloud")
             {
                 localOptions.isPointCloud = true;
             }
+            else if (key == "draco_deindex")
+            {
+                localOptions.deindex = true;
+            }
+            else if (key == "draco_structured")
+            {
+                localOptions.structured = true;
+            }
+            else if (key == "draco_instancing")
+            {
+                localOptions.instancing = true;
+            }
+            else if (key == "draco_instance_hash")
+            {
+                localOptions.instanceHash = true;
+            }
+            else if (key == "draco_compact")
+            {
+                localOptions.compact = true;
+            }
+            else if (key == "draco_compact_positions")
+            {
+                localOptions.compactPositions = true;
+            }
+            else if (key == "draco_optimize")
+            {
+                localOptions.optimize = true;
+            }
+            else if (key == "draco_kdtree")
+            {
+                localOptions.kdTree = true;
+            }
+            else if (key == "draco_attributes")
+            {
+                valid = parseAttributeList(value, localOptions.attributes);
+            }
+            else if (key == "draco_cache")
+            {
+                int megabytes = 0;
+                valid = parseIntOption(value, 0, 1 << 20, megabytes);
+                localOptions.cacheBytes = static_cast<size_t>(megabytes) << 20;
+            }
+            else if (key == "draco_cache_dir")
+            {
+                localOptions.cacheDir = value;
+                valid = !value.empty();
+            }
+            else if (key == "draco_tile_points")
+            {
+                valid = parseIntOption(value, 0, std::numeric_limits<int>::max(), localOptions.tilePoints);
+            }
+            else if (key == "draco_lod")
+            {
+                valid = parseIntOption(value, 0, 4, localOptions.lodLevels);
+            }
+            else if (key == "draco_lod_skip")
+            {
+                valid = parseIntOption(value, 0, 4, localOptions.lodSkip);
+            }
+            else if (key == "draco_lod_paged")
+            {
+                localOptions.lodPaged = true;
+            }
+            else if (key == "draco_dedup")
+            {
+                encoder.deduplicate = true;
+            }
+            else if (key == "draco_pos_bits")
+            {
+                valid = parseIntOption(value, 0, 30, encoder.pos_quantization_bits);
+            }
+            else if (key == "draco_tex_bits")
+            {
+                valid = parseIntOption(value, 0, 30, encoder.tex_coords_quantization_bits);
+            }
+            else if (key == "draco_normal_bits")
+            {
+                valid = parseIntOption(value, 0, 30, encoder.normals_quantization_bits);
+            }
+            else if (key == "draco_compression_level")
+            {
+                valid = parseIntOption(value, 0, 10, encoder.compression_level);
+            }
+            else if (key == "draco_encode_speed")
+            {
+                valid = parseIntOption(value, 0, 10, encoder.encode_speed);
+            }
+            else if (key == "draco_decode_speed")
+            {
+                valid = parseIntOption(value, 0, 10, encoder.decode_speed);
+            }
+            else if (key == "draco_threads")
+            {
+                valid = parseIntOption(value, 0, 256, encoder.num_threads);
+            }
+            else if (key == "draco_method")
+            {
+                if (value == "edgebreaker") encoder.encoding_method = draco::MESH_EDGEBREAKER_ENCODING;
+                else if (value == "sequential") encoder.encoding_method = draco::MESH_SEQUENTIAL_ENCODING;
+                else valid = false;
+            }
+
+            if (!valid && localOptions.error.empty())
+            {
+                localOptions.error = "invalid draco option " + opt;
+            }
         }
     }
 
     return localOptions;
 }
 
+//the read options that change the decoded scene graph, in a fixed order.
+//cache size, cache dir, threads and encoder options are left out so their
+//callers share cache entries
+std::string cacheKeyOptions(const DarocOptionsStruct& dos)
+{
+    std::ostringstream oss;
+    oss << "deindex=" << dos.deindex
+        << " compact=" << dos.compact
+        << " compact_positions=" << dos.compactPositions
+        << " optimize=" << dos.optimize
+        << " kdtree=" << dos.kdTree
+        << " attributes=" << dos.attributes
+        << " lod_skip=" << dos.lodSkip
+        << " subtree=" << dos.subtreeRoot;
+    //paged LODs carry the name of their file
+    if (dos.lodPaged && dos.subtreeRoot < 0) oss << " lod_paged=" << dos.sourceFile;
+    return oss.str();
+}
+
+
+//one float attribute with identity mapping, returns its id
+int addDracoAttribute(draco::PointCloud* pc, draco::GeometryAttribute::Type type,
+    const osg::Array& array, uint16_t custom_id)
+{
+    const int num_components = array.getDataSize();
+    draco::GeometryAttribute va;
+    va.Init(type, nullptr, num_components, draco::DT_FLOAT32, false,
+        sizeof(float) * num_components, 0);
+    va.set_custom_id(custom_id);
+    int att_id = pc->AddAttribute(va, true, array.getNumElements());
+
+    const float* values = static_cast<const float*>(array.getDataPointer());
+    draco::PointAttribute* att = pc->attribute(att_id);
+    for (unsigned int i = 0; i < array.getNumElements(); i++)
+    {
+        att->SetAttributeValue(draco::AttributeValueIndex(i), values + i * num_components);
+    }
+    return att_id;
+}
 
-//osg node to daroc data
-void osgNodeToDarocAttribute(GeometryFlat* gf, draco::PointCloud* pc)
+//colors are stored as normalized 8 bit, which is all a display can show
+int addDracoColorAttribute(draco::PointCloud* pc, const osg::Vec4Array& colors)
 {
-    //num
-    size_t num_positions_ = gf->m_geomtry_data.raw_vertex->size();
-    size_t num_tex_coords_ = gf->m_geomtry_data.raw_uv0->size();
-    size_t num_normals_ = gf->m_geomtry_data.raw_normal->size();
-    size_t num_obj_faces_ = num_positions_ / 3;
+    draco::GeometryAttribute va;
+    va.Init(draco::GeometryAttribute::COLOR, nullptr, 4, draco::DT_UINT8, true,
+        sizeof(uint8_t) * 4, 0);
+    int att_id = pc->AddAttribute(va, true, colors.size());
 
-    // attribute id
-    int pos_att_id_ = 0;
-    int tex_att_id_ = 0;
-    int norm_att_id_ = 0;
+    draco::PointAttribute* att = pc->attribute(att_id);
+    for (size_t i = 0; i < colors.size(); i++)
+    {
+        uint8_t c[4];
+        for (int k = 0; k < 4; k++)
+        {
+            float v = std::min(std::max(colors[i][k], 0.0f), 1.0f);
+            c[k] = static_cast<uint8_t>(v * 255.0f + 0.5f);
+        }
+        att->SetAttributeValue(draco::AttributeValueIndex(i), c);
+    }
+    return att_id;
+}
 
+//osg node to daroc data. texture units and generic attribute indices are
+//kept in the draco custom id so the reader can put them back in their slot
+void osgNodeToDarocAttribute(const GeometryData& data, draco::PointCloud* pc)
+{
     // Add attributes if they are present in the input data.
-    if (num_positions_ > 0)
+    if (!data.raw_vertex->empty())
     {
-        draco::GeometryAttribute va;
-        va.Init(draco::GeometryAttribute::POSITION, nullptr, 3, draco::DT_FLOAT32, false,
-            sizeof(float) * 3, 0);
-        pos_att_id_ = pc->AddAttribute(va, true, num_positions_);
+        addDracoAttribute(pc, draco::GeometryAttribute::POSITION, *data.raw_vertex, 0);
     }
-    if (num_tex_coords_ > 0)
+    if (data.raw_normal.valid() && !data.raw_normal->empty())
     {
-        draco::GeometryAttribute va;
-        va.Init(draco::GeometryAttribute::TEX_COORD, nullptr, 2, draco::DT_FLOAT32, false,
-            sizeof(float) * 2, 0);
-        tex_att_id_ = pc->AddAttribute(va, true, num_tex_coords_);
+        addDracoAttribute(pc, draco::GeometryAttribute::NORMAL, *data.raw_normal, 0);
     }
-    if (num_normals_ > 0)
+    if (data.raw_color.valid() && !data.raw_color->empty())
     {
-        draco::GeometryAttribute va;
-        va.Init(draco::GeometryAttribute::NORMAL, nullptr, 3, draco::DT_FLOAT32, false,
-            sizeof(float) * 3, 0);
-        norm_att_id_ = pc->AddAttribute(va, true, num_normals_);
+        addDracoColorAttribute(pc, *data.raw_color);
     }
+    for (GeometryData::TexCoordMap::const_iterator itr = data.raw_uv.begin(); itr != data.raw_uv.end(); ++itr)
+    {
+        if (itr->second->empty()) continue;
+        addDracoAttribute(pc, draco::GeometryAttribute::TEX_COORD, *itr->second, itr->first);
+    }
+    for (GeometryData::AttribMap::const_iterator itr = data.raw_attrib.begin(); itr != data.raw_attrib.end(); ++itr)
+    {
+        if (itr->second->getNumElements() == 0) continue;
+        addDracoAttribute(pc, draco::GeometryAttribute::GENERIC, *itr->second, itr->first);
+    }
+}
 
-    //num_positions_ = 0;
-    //num_tex_coords_ = 0;
-    //num_normals_ = 0;
-    //int num_positions_i = 0;
-    //int num_tex_coords_i = 0;
-    //int num_normals_i = 0;
-
-    for (size_t i = 0; i < num_positions_; i++)
+//convert one draco value of type T to float components, integer types are
+//scaled to [0,1] / [-1,1] when normalized, missing components get 0 (w = 1)
+template<typename T>
+inline void dracoValueToFloats(const uint8_t* src, int src_components, bool normalized,
+    float* dst, int dst_components)
+{
+    const float scale = (normalized && std::numeric_limits<T>::is_integer)
+        ? 1.0f / static_cast<float>(std::numeric_limits<T>::max()) : 1.0f;
+    const int n = std::min(src_components, dst_components);
+    for (int c = 0; c < n; ++c)
+    {
+        T value;
+        memcpy(&value, src + c * sizeof(T), sizeof(T));
+        dst[c] = static_cast<float>(value) * scale;
+    }
+    for (int c = n; c < dst_components; ++c)
     {
-        float v[3];
-        v[0] = (*gf->m_geomtry_data.raw_vertex)[i].x();
-        v[1] = (*gf->m_geomtry_data.raw_vertex)[i].y();
-        v[2] = (*gf->m_geomtry_data.raw_vertex)[i].z();
-        pc->attribute(pos_att_id_)->SetAttributeValue(draco::AttributeValueIndex(i), v);
-        //pc->attribute(pos_att_id_)->SetPointMapEntry(draco::PointIndex(i),draco::AttributeValueIndex(i));
+        dst[c] = (c == 3) ? 1.0f : 0.0f;
     }
+}
 
-    for (size_t i = 0; i < num_tex_coords_; i++)
+//convert a whole attribute, walking the value buffer linearly when the point
+//map is the identity and looking each point up otherwise
+template<typename T>
+void dracoAttributeToFloats(const draco::PointAttribute& att, size_t num_points,
+    float* dst, int dst_components)
+{
+    const int src_components = att.components_count();
+    const bool normalized = att.normalized();
+
+    if (att.is_mapping_identity())
+    {
+        const uint8_t* src = att.GetAddress(draco::AttributeValueIndex(0));
+        const size_t stride = att.byte_stride();
+        for (size_t i = 0; i < num_points; ++i, src += stride, dst += dst_components)
+        {
+            dracoValueToFloats<T>(src, src_components, normalized, dst, dst_components);
+        }
+    }
+    else
     {
-        float uv[2];
-        uv[0] = (*gf->m_geomtry_data.raw_uv0)[i].x();
-        uv[1] = (*gf->m_geomtry_data.raw_uv0)[i].y();
-        pc->attribute(tex_att_id_)->SetAttributeValue(draco::AttributeValueIndex(i), uv);
-        //pc->attribute(tex_att_id_)->SetPointMapEntry(draco::PointIndex(i), draco::AttributeValueIndex(i));
+        for (draco::PointIndex i(0); i < num_points; ++i, dst += dst_components)
+        {
+            dracoValueToFloats<T>(att.GetAddress(att.mapped_index(i)),
+                src_components, normalized, dst, dst_components);
+        }
     }
+}
 
-    for (size_t i = 0; i < num_normals_; i++)
+//bounds of three component float elements
+inline void expandBounds(const float* values, size_t count, osg::BoundingBox& bounds)
+{
+    for (size_t i = 0; i < count; i++, values += 3)
     {
-        float n[3];
-        n[0] = (*gf->m_geomtry_data.raw_normal)[i].x();
-        n[1] = (*gf->m_geomtry_data.raw_normal)[i].y();
-        n[2] = (*gf->m_geomtry_data.raw_normal)[i].z();
-        pc->attribute(norm_att_id_)->SetAttributeValue(draco::AttributeValueIndex(i), n);
-        //pc->attribute(norm_att_id_)->SetPointMapEntry(draco::PointIndex(i), draco::AttributeValueIndex(i));
+        bounds.expandBy(values[0], values[1], values[2]);
     }
 }
 
-class ReaderWriterDRC
-    : public osgDB::ReaderWriter
+//draco attribute to a pre-sized osg array, empty if the attribute is missing.
+//with bounds the values are also added to it, for three components only
+template<class ArrayT>
+ArrayT* dracoAttributeToArray(const draco::PointAttribute* att, size_t num_points,
+    osg::BoundingBox* bounds = NULL)
 {
-public:
+    typedef typename ArrayT::ElementDataType ElementT;
 
-    ReaderWriterDRC()
+    osg::ref_ptr<ArrayT> array = new ArrayT();
+    const int num_components = array->getDataSize();
+    if (!att || att->size() == 0 || num_points == 0) return array.release();
+    if (att->is_mapping_identity() && att->size() < num_points)
     {
-        supportsExtension("drc", "Daroc format");
-
-        supportsOption("draco_point_cloud", "save file as PointCloud");
+        OSG_WARN << "draco attribute has fewer values than points" << std::endl;
+        return array.release();
     }
 
-    virtual const char* className() const { return "Daroc reader/writer"; }
+    array->resize(num_points);
+    float* dst = reinterpret_cast<float*>(&(*array)[0]);
 
-    virtual ReadResult readNode(const std::string& file, const osgDB::ReaderWriter::Options* options) const
+    //same layout as the osg element, one bulk copy. bounds are taken in the
+    //same loop so the positions are walked once
+    if (att->is_mapping_identity()
+        && att->data_type() == draco::DT_FLOAT32
+        && att->components_count() == num_components
+        && att->byte_stride() == sizeof(ElementT))
     {
-        std::string ext = osgDB::getLowerCaseFileExtension(file);
-        if (!acceptsExtension(ext)) return ReadResult::FILE_NOT_HANDLED;
+        const float* src = reinterpret_cast<const float*>(att->GetAddress(draco::AttributeValueIndex(0)));
+        if (bounds && num_components == 3)
+        {
+            osg::BoundingBox& bb = *bounds;
+            for (size_t i = 0; i < num_points; i++, src += 3, dst += 3)
+            {
+                dst[0] = src[0];
+                dst[1] = src[1];
+                dst[2] = src[2];
+                bb.expandBy(src[0], src[1], src[2]);
+            }
+            return array.release();
+        }
+        memcpy(dst, src, num_points * sizeof(ElementT));
+        return array.release();
+    }
 
-        std::string fileName = osgDB::findDataFile(file, options);
-        if (fileName.empty()) return ReadResult::FILE_NOT_FOUND;
+    switch (att->data_type())
+    {
+    case draco::DT_INT8: dracoAttributeToFloats<int8_t>(*att, num_points, dst, num_components); break;
+    case draco::DT_UINT8: dracoAttributeToFloats<uint8_t>(*att, num_points, dst, num_components); break;
+    case draco::DT_INT16: dracoAttributeToFloats<int16_t>(*att, num_points, dst, num_components); break;
+    case draco::DT_UINT16: dracoAttributeToFloats<uint16_t>(*att, num_points, dst, num_components); break;
+    case draco::DT_INT32: dracoAttributeToFloats<int32_t>(*att, num_points, dst, num_components); break;
+    case draco::DT_UINT32: dracoAttributeToFloats<uint32_t>(*att, num_points, dst, num_components); break;
+    case draco::DT_FLOAT32: dracoAttributeToFloats<float>(*att, num_points, dst, num_components); break;
+    case draco::DT_FLOAT64: dracoAttributeToFloats<double>(*att, num_points, dst, num_components); break;
+    default:
+        OSG_WARN << "unsupported draco attribute data type " << att->data_type() << std::endl;
+        array->clear();
+        break;
+    }
 
-        OSG_INFO << "Reading file " << fileName << std::endl;
+    //converted values are still in cache
+    if (bounds && num_components == 3 && !array->empty()) expandBounds(dst, array->getNumElements(), *bounds);
+    return array.release();
+}
+
+//draco face list to osg DrawElements
+template<class DrawElementsT>
+DrawElementsT* dracoFacesToDrawElements(const draco::Mesh& mesh)
+{
+    typedef typename DrawElementsT::value_type IndexType;
+
+    osg::ref_ptr<DrawElementsT> elements = new DrawElementsT(osg::PrimitiveSet::TRIANGLES);
+    elements->reserve(mesh.num_faces() * 3);
+    for (draco::FaceIndex i(0); i < mesh.num_faces(); ++i)
+    {
+        const draco::Mesh::Face& f = mesh.face(i);
+        elements->push_back(static_cast<IndexType>(f[0].value()));
+        elements->push_back(static_cast<IndexType>(f[1].value()));
+        elements->push_back(static_cast<IndexType>(f[2].value()));
+    }
+    return elements.release();
+}
 
-        osg::Group* ret = new osg::Group();
+//pick the smallest index type able to address every point
+osg::DrawElements* dracoFacesToDrawElements(const draco::Mesh& mesh, size_t num_points)
+{
+    if (num_points <= 0xFFFF)
+    {
+        return dracoFacesToDrawElements<osg::DrawElementsUShort>(mesh);
+    }
+    return dracoFacesToDrawElements<osg::DrawElementsUInt>(mesh);
+}
 
-        // open input stream
-        std::ifstream input_file(fileName, std::ios::binary);
-        if (!input_file)
+//draco_compact normals, snorm16 is finer than any normal quantization
+osg::Vec3sArray* compactNormals(const osg::Vec3Array& normals)
+{
+    osg::ref_ptr<osg::Vec3sArray> result = new osg::Vec3sArray(normals.size());
+    for (size_t i = 0; i < normals.size(); i++)
+    {
+        for (int c = 0; c < 3; c++)
         {
-            printf("Failed opening the input file.\n");
-            return ReadResult::FILE_NOT_FOUND;
+            float v = std::min(std::max(normals[i][c], -1.0f), 1.0f);
+            (*result)[i][c] = static_cast<short>(floorf(v * 32767.0f + 0.5f));
         }
+    }
+    result->setBinding(osg::Array::BIND_PER_VERTEX);
+    result->setNormalize(true);
+    return result.release();
+}
 
-        // Read the file stream into a buffer.
-        std::streampos file_size = 0;
-        input_file.seekg(0, std::ios::end);
-        file_size = input_file.tellg() - file_size;
-        input_file.seekg(0, std::ios::beg);
-        std::vector<char> data(file_size);
-        input_file.read(data.data(), file_size);
-        if (data.empty())
+//draco_compact colors, draco already stores them as 8 bit
+osg::Vec4ubArray* compactColors(const osg::Vec4Array& colors)
+{
+    osg::ref_ptr<osg::Vec4ubArray> result = new osg::Vec4ubArray(colors.size());
+    for (size_t i = 0; i < colors.size(); i++)
+    {
+        for (int c = 0; c < 4; c++)
         {
-            printf("Empty input file.\n");
-            return ReadResult::FILE_NOT_FOUND;
+            float v = std::min(std::max(colors[i][c], 0.0f), 1.0f);
+            (*result)[i][c] = static_cast<unsigned char>(v * 255.0f + 0.5f);
         }
+    }
+    result->setBinding(osg::Array::BIND_PER_VERTEX);
+    result->setNormalize(true);
+    return result.release();
+}
 
-        // Create a draco decoding buffer. Note that no data is copied in this step.
-        draco::DecoderBuffer buffer;
-        buffer.Init(data.data(), data.size());
-
-        draco::CycleTimer timer;
-        // Decode the input data into a geometry.
-        std::unique_ptr<draco::PointCloud> pc;
-        draco::Mesh *mesh = nullptr;
-        const draco::EncodedGeometryType geom_type =
-            draco::GetEncodedGeometryType(&buffer);
-        if (geom_type == draco::TRIANGULAR_MESH) {
-            timer.Start();
-            std::unique_ptr<draco::Mesh> in_mesh = draco::DecodeMeshFromBuffer(&buffer);
-            timer.Stop();
-            if (in_mesh) {
-                mesh = in_mesh.get();
-                pc = std::move(in_mesh);
-            }
-        }
-        else if (geom_type == draco::POINT_CLOUD) {
-            // Failed to decode it as mesh, so let's try to decode it as a point cloud.
-            timer.Start();
-            pc = draco::DecodePointCloudFromBuffer(&buffer);
-            timer.Stop();
-        }
+//draco_compact_positions, 16 bits per axis over the bounding box. the
+//shader restores gl_Vertex.xyz * scale + offset
+osg::Vec3sArray* compactPositions(const osg::Vec3Array& vertices, const osg::BoundingBox& bb,
+    osg::Vec3& scale, osg::Vec3& offset)
+{
+    for (int c = 0; c < 3; c++)
+    {
+        float range = bb._max[c] - bb._min[c];
+        scale[c] = range > 0.0f ? range / 65535.0f : 1.0f;
+        offset[c] = bb._min[c] + 32768.0f * scale[c];
+    }
 
-        if (pc == nullptr)
+    osg::ref_ptr<osg::Vec3sArray> result = new osg::Vec3sArray(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        for (int c = 0; c < 3; c++)
         {
-            printf("Failed to decode the input file.\n");
-            return ReadResult::FILE_NOT_FOUND;
+            float q = floorf((vertices[i][c] - bb._min[c]) / scale[c] + 0.5f);
+            q = std::min(std::max(q, 0.0f), 65535.0f);
+            (*result)[i][c] = static_cast<short>(static_cast<int>(q) - 32768);
         }
+    }
+    result->setBinding(osg::Array::BIND_PER_VERTEX);
+    return result.release();
+}
 
+//bounds taken while decoding, so osg does not walk the vertices again. a
+//tracked vertex array that is replaced or dirtied falls back to the osg
+//computation, without one (compact positions, which osg cannot compute
+//bounds of) the decoded bounds are always reported
+struct StoredBoundCallback : public osg::Drawable::ComputeBoundingBoxCallback
+{
+    StoredBoundCallback(const osg::BoundingBox& bb, const osg::Array* positions = NULL)
+        : m_bb(bb)
+    {
+        track(positions);
+    }
 
+    //the positions the bounds belong to, again after reordering them
+    void track(const osg::Array* positions)
+    {
+        m_positions = positions;
+        m_modified = positions ? positions->getModifiedCount() : 0;
+    }
 
-        //get index attribute 
-        osg::ref_ptr<osg::Vec3Array> index_vertex = new osg::Vec3Array();
-        osg::ref_ptr<osg::Vec3Array> index_normal = new osg::Vec3Array();
-        osg::ref_ptr<osg::Vec4Array> index_color = new osg::Vec4Array();
-        osg::ref_ptr<osg::Vec2Array> index_uv0 = new osg::Vec2Array();
+    virtual osg::BoundingBox computeBound(const osg::Drawable& drawable) const
+    {
+        if (!m_positions) return m_bb;
 
-        //vertex
-        const draco::PointAttribute *const att_vertex =
-            pc->GetNamedAttribute(draco::GeometryAttribute::POSITION);
-        if (att_vertex && att_vertex->size() > 0)
+        const osg::Geometry* geometry = drawable.asGeometry();
+        if (geometry && geometry->getVertexArray() == m_positions
+            && m_positions->getModifiedCount() == m_modified)
         {
-            std::array<float, 3> value;
-            int size = std::max<int>(att_vertex->size(), att_vertex->indices_map_.size());
-            for (draco::PointIndex i(0); i < size; ++i)
-            {
-                att_vertex->GetMappedValue(i, &value[0]);
-                index_vertex->push_back(osg::Vec3(value[0], value[1], value[2]));
-            }
+            return m_bb;
         }
+        return drawable.computeBoundingBox();
+    }
 
-        //normal
-        const draco::PointAttribute *const att_normal =
-            pc->GetNamedAttribute(draco::GeometryAttribute::NORMAL);
-        if (att_normal && att_normal->size() > 0)
+    osg::BoundingBox m_bb;
+    const osg::Array* m_positions;
+    unsigned int m_modified;
+};
+
+//osgb keeps neither the StoredBoundCallback nor the osg::KdTree of a
+//decoded Geometry. after reading a cached copy both are set again, the
+//bounds in one walk over the positions instead of one per bound request
+class DecodedTreeRestorer : public osg::NodeVisitor
+{
+public:
+    DecodedTreeRestorer(bool kd_tree)
+        : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN)
+        , m_kd_tree(kd_tree)
+        , m_kdtree_ms(0.0)
+    {
+    }
+
+    virtual void apply(osg::Geode& geode)
+    {
+        for (unsigned int i = 0; i < geode.getNumDrawables(); i++)
         {
-            std::array<float, 3> value;
-            int size = std::max<int>(att_normal->size(), att_normal->indices_map_.size());
-            for (draco::PointIndex i(0); i < size; ++i)
-            {
-                att_normal->GetMappedValue(i, &value[0]);
-                index_normal->push_back(osg::Vec3(value[0], value[1], value[2]));
-            }
+            osg::Geometry* geometry = geode.getDrawable(i)->asGeometry();
+            if (geometry) restore(*geometry);
         }
+        traverse(geode);
+    }
+
+    void restore(osg::Geometry& geometry)
+    {
+        osg::Vec3Array* vertex = dynamic_cast<osg::Vec3Array*>(geometry.getVertexArray());
+        if (!vertex) return;
 
-        //uv0
-        const draco::PointAttribute *const att_uv0 =
-            pc->GetNamedAttribute(draco::GeometryAttribute::TEX_COORD);
-        if (att_uv0 && att_uv0->size() > 0)
+        if (!dynamic_cast<StoredBoundCallback*>(geometry.getComputeBoundingBoxCallback()))
         {
-            std::array<float, 2> value;
-            int size = std::max<int>(att_uv0->size(), att_uv0->indices_map_.size());
-            for (draco::PointIndex i(0); i < size; ++i)
-            {
-                att_uv0->GetMappedValue(i, &value[0]);
-                index_uv0->push_back(osg::Vec2(value[0], value[1]));
-            }
+            osg::BoundingBox bounds;
+            for (size_t i = 0; i < vertex->size(); i++) bounds.expandBy((*vertex)[i]);
+            geometry.setComputeBoundingBoxCallback(new StoredBoundCallback(bounds, vertex));
         }
 
-        //color
-        const draco::PointAttribute *const att_color =
-            pc->GetNamedAttribute(draco::GeometryAttribute::COLOR);
-        if (att_color && att_color->size() > 0)
+        if (m_kd_tree && !dynamic_cast<osg::KdTree*>(geometry.getShape()))
         {
-            std::array<float, 4> value;
-            int size = std::max<int>(att_color->size(), att_color->indices_map_.size());
-            for (draco::PointIndex i(0); i < size; ++i)
-            {
-                att_color->GetMappedValue(i, &value[0]);
-                index_color->push_back(osg::Vec4(value[0], value[1], value[2], value[3]));
-            }
+            osg::Timer_t kdtree_start = osg::Timer::instance()->tick();
+            osg::ref_ptr<osg::KdTree> kd_tree = new osg::KdTree();
+            osg::KdTree::BuildOptions build_options;
+            if (kd_tree->build(build_options, &geometry)) geometry.setShape(kd_tree.get());
+            m_kdtree_ms += osg::Timer::instance()->delta_m(kdtree_start, osg::Timer::instance()->tick());
         }
+    }
 
+    bool m_kd_tree;
+    double m_kdtree_ms;
+};
 
-        if (mesh)
-        {
-            printf("import Mesh\n");
-
-            // to raw
-            osg::ref_ptr<osg::Vec3Array> raw_vertex = new osg::Vec3Array();
-            osg::ref_ptr<osg::Vec3Array> raw_normal = new osg::Vec3Array();
-            osg::ref_ptr<osg::Vec4Array> raw_color = new osg::Vec4Array();
-            osg::ref_ptr<osg::Vec2Array> raw_uv0 = new osg::Vec2Array();
+//osgb serialized stateset for the container, empty on failure
+std::string stateSetToBlob(const osg::StateSet& stateset)
+{
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension("osgb");
+    if (!rw) return std::string();
 
-            //get face index
-            for (auto i = 0; i < mesh->num_faces(); i++)
-            {
-                draco::Mesh::Face f = mesh->face(draco::FaceIndex(i));
+    osg::ref_ptr<osgDB::Options> options = new osgDB::Options("WriteImageHint=IncludeData");
+    std::ostringstream out(std::ios::out | std::ios::binary);
+    if (!rw->writeObject(stateset, out, options.get()).success()) return std::string();
+    return out.str();
+}
 
-                int f0 = f[0].value();
-                int f1 = f[1].value();
-                int f2 = f[2].value();
+osg::StateSet* blobToStateSet(const char* data, size_t size)
+{
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension("osgb");
+    if (!rw) return NULL;
 
-                if (index_vertex->size() > 0)
-                {
-                    raw_vertex->push_back((*index_vertex)[f0]);
-                    raw_vertex->push_back((*index_vertex)[f1]);
-                    raw_vertex->push_back((*index_vertex)[f2]);
-                }
-                if (index_normal->size() > 0)
-                {
-                    raw_normal->push_back((*index_normal)[f0]);
-                    raw_normal->push_back((*index_normal)[f1]);
-                    raw_normal->push_back((*index_normal)[f2]);
-                }
-                if (index_color->size() > 0)
-                {
-                    raw_color->push_back((*index_color)[f0]);
-                    raw_color->push_back((*index_color)[f1]);
-                    raw_color->push_back((*index_color)[f2]);
-                }
-                if (index_uv0->size() > 0)
-                {
-                    raw_uv0->push_back((*index_uv0)[f0]);
-                    raw_uv0->push_back((*index_uv0)[f1]);
-                    raw_uv0->push_back((*index_uv0)[f2]);
-                }
-            }
+    std::istringstream in(std::string(data, size), std::ios::in | std::ios::binary);
+    osgDB::ReaderWriter::ReadResult rr = rw->readObject(in, NULL);
+    osg::ref_ptr<osg::StateSet> stateset = dynamic_cast<osg::StateSet*>(rr.getObject());
+    return stateset.release();
+}
 
-            //new triangles geometry
-            osg::ref_ptr<osg::Geometry> geometry = new osg::Geometry();
-            if (raw_vertex->size() > 0)
-            {
-                geometry->setVertexArray(raw_vertex);
-            }
-            if (raw_normal->size() > 0)
-            {
-                geometry->setNormalArray(raw_normal);
-                geometry->setNormalBinding(osg::Geometry::AttributeBinding::BIND_PER_VERTEX);
-            }
-            if (raw_uv0->size() > 0)
-            {
-                geometry->setTexCoordArray(0, raw_uv0);
-            }
-            if (raw_color->size() > 0)
-            {
-                geometry->setColorArray(raw_color);
-                geometry->setColorBinding(osg::Geometry::BIND_PER_VERTEX);
-            }
+class ReaderWriterDRC
+    : public osgDB::ReaderWriter
+{
+public:
 
-            if (raw_vertex->size() > 0)
-            {
-                geometry->addPrimitiveSet(
-                    new osg::DrawArrays(osg::PrimitiveSet::TRIANGLES, 0, raw_vertex->size()));
+    ReaderWriterDRC()
+    {
+        supportsExtension("drc", "Daroc format");
+        supportsExtension("drclevel", "one level of a paged draco LOD, <file>.drc.<node>.drclevel");
 
-                //geode
-                osg::Geode* geode = new osg::Geode();
-                geode->addDrawable(geometry);
-                ret->addChild(geode);
-            }
+        supportsOption("draco_point_cloud", "save file as PointCloud");
+        supportsOption("draco_deindex", "read meshes as de-indexed DrawArrays triangles (legacy)");
+        supportsOption("draco_structured", "save one draco mesh per Geometry and keep the node hierarchy and StateSets");
+        supportsOption("draco_instancing", "save a Geometry shared by several transforms once with per instance matrices");
+        supportsOption("draco_instance_hash", "also share content identical Geometry when instancing");
+        supportsOption("draco_compact", "read normals as normalized Vec3sArray and colors as Vec4ubArray");
+        supportsOption("draco_compact_positions", "read positions as Vec3sArray, a shader must apply the draco_position_scale/offset uniforms");
+        supportsOption("draco_optimize", "reorder decoded triangles and vertices for the post-transform vertex cache");
+        supportsOption("draco_kdtree", "build an osg::KdTree for every decoded Geometry, not with draco_compact_positions");
+        supportsOption("draco_attributes=<list>", "convert only these of position,normal,color,texcoord,generic on read, positions always");
+        supportsOption("draco_cache=<MB>", "keep decoded files in a shared LRU cache of at least this many MB, the largest size asked for in the process wins, repeat reads share the arrays");
+        supportsOption("draco_cache_dir=<dir>", "also keep decoded files as osgb in dir for later runs");
+        supportsOption("draco_tile_points=<n>", "with draco_point_cloud, save an octree of chunks with at most n points each");
+        supportsOption("draco_lod=<0-4>", "also save n coarser levels from vertex clustering with fewer quantization bits, read as osg::LOD");
+        supportsOption("draco_lod_skip=<0-4>", "drop the n finest levels of each LOD for a cheaper read, they are not decoded or refined later");
+        supportsOption("draco_lod_paged", "read files with LOD levels as osg::PagedLOD, the coarsest level at once and the finer ones later through the database pager, coarse to fine");
+        supportsOption("draco_dedup", "merge duplicate vertices before encoding, slower but can be smaller");
+        supportsOption("draco_pos_bits=<n>", "position quantization bits, 0 disables quantization (default 14)");
+        supportsOption("draco_tex_bits=<n>", "texture coordinate quantization bits, 0 disables quantization (default 12)");
+        supportsOption("draco_normal_bits=<n>", "normal quantization bits, 0 disables quantization (default 10)");
+        supportsOption("draco_compression_level=<0-10>", "0 = fastest, 10 = best compression (default 0)");
+        supportsOption("draco_encode_speed=<0-10>", "encoder speed, overrides draco_compression_level");
+        supportsOption("draco_decode_speed=<0-10>", "decoder speed, overrides draco_compression_level");
+        supportsOption("draco_method=<edgebreaker|sequential>", "mesh connectivity encoding method");
+        supportsOption("draco_threads=<n>", "worker threads for flattening, encoding and container decoding, 0 = one per core (default 1)");
+    }
 
+    virtual const char* className() const { return "Daroc reader/writer"; }
 
-        }
-        else
-        {
-            printf("import PointCloud\n");
+    virtual ReadResult readNode(const std::string& file, const osgDB::ReaderWriter::Options* options) const
+    {
+        std::string ext = osgDB::getLowerCaseFileExtension(file);
+        if (!acceptsExtension(ext)) return ReadResult::FILE_NOT_HANDLED;
 
-            //new points geometry
-            osg::ref_ptr<osg::Geometry> geometry = new osg::Geometry();
-            if (index_vertex->size() > 0)
-            {
-                geometry->setVertexArray(index_vertex);
-            }
-            if (index_normal->size() > 0)
+        //one level of a paged LOD, named <file>.drc.<node>.drclevel
+        std::string data_file = file;
+        int subtree = -1;
+        if (ext == "drclevel")
+        {
+            const std::string level = osgDB::getNameLessExtension(file);
+            if (!parseIntOption(osgDB::getFileExtension(level), 0, std::numeric_limits<int>::max(), subtree))
             {
-                geometry->setNormalArray(index_normal);
-                geometry->setNormalBinding(osg::Geometry::AttributeBinding::BIND_PER_VERTEX);
+                return ReadResult::FILE_NOT_HANDLED;
             }
-            if (index_uv0->size() > 0)
+            data_file = osgDB::getNameLessExtension(level);
+        }
+
+        std::string fileName = osgDB::findDataFile(data_file, options);
+        if (fileName.empty()) return ReadResult::FILE_NOT_FOUND;
+
+        OSG_INFO << "Reading file " << fileName << std::endl;
+
+        // map the input file, falls back to a buffered read
+        MappedFile input_file;
+        if (!input_file.open(fileName))
+        {
+            OSG_WARN << "Failed opening the input file " << fileName << std::endl;
+            return ReadResult::FILE_NOT_FOUND;
+        }
+        if (input_file.size() == 0)
+        {
+            OSG_WARN << "Empty input file " << fileName << std::endl;
+            return ReadResult::FILE_NOT_FOUND;
+        }
+
+        // decoded geometry owns its data, the mapping is released on return
+        return readData(input_file.data(), input_file.size(), options, fileName, subtree);
+    }
+
+    virtual ReadResult readNode(std::istream& fin, const osgDB::ReaderWriter::Options* options) const
+    {
+        //memory the application already holds, see readDracoNode
+        if (const DracoMemoryStreamBuf* memory = dynamic_cast<const DracoMemoryStreamBuf*>(fin.rdbuf()))
+        {
+            return readBuffer(memory->current(), memory->remaining(), options);
+        }
+
+        std::vector<char> data;
+        if (!readStreamToBuffer(fin, data))
+        {
+            OSG_WARN << "Empty input stream." << std::endl;
+            return ReadResult::ERROR_IN_READING_FILE;
+        }
+
+        return readBuffer(data.data(), data.size(), options);
+    }
+
+    //decode a draco payload or container already in memory, no data is copied.
+    //applications reach it through readDracoNode in DracoMemoryStream.h
+    ReadResult readBuffer(const char* data, size_t size, const osgDB::ReaderWriter::Options* options) const
+    {
+        return readData(data, size, options, std::string(), -1);
+    }
+
+    //readBuffer for data from file_name, which paged LOD levels refer to.
+    //with subtree only that container node and the nodes below it are read
+    ReadResult readData(const char* data, size_t size, const osgDB::ReaderWriter::Options* options,
+        const std::string& file_name, int subtree) const
+    {
+        if (!data || size == 0) return ReadResult::ERROR_IN_READING_FILE;
+
+        //a mistyped option would silently drop attributes or the cache
+        DarocOptionsStruct dos = parseOptions(options);
+        if (!dos.error.empty())
+        {
+            OSG_WARN << dos.error << std::endl;
+            return ReadResult(dos.error);
+        }
+        dos.sourceFile = file_name;
+        dos.subtreeRoot = subtree;
+        if (dos.lodPaged && file_name.empty())
+        {
+            OSG_INFO << "draco_lod_paged needs a file name, every LOD level is read at once." << std::endl;
+        }
+
+        DracoStatistics stats;
+        stats.input_bytes = size;
+
+        //the same data read with the same options before. osgb cannot store
+        //the bound callback of compact positions, those stay in memory only
+        const bool use_memory = dos.cacheBytes > 0;
+        const bool use_disk = !dos.cacheDir.empty() && !dos.compactPositions;
+        DracoDecodeCache::Key key;
+        osg::ref_ptr<osg::Node> cached;
+        if (use_memory || use_disk)
+        {
+            key = DracoDecodeCache::makeKey(data, size, cacheKeyOptions(dos));
+        }
+        if (use_memory)
+        {
+            m_cache.growCapacity(dos.cacheBytes);
+            cached = m_cache.get(key);
+        }
+        if (!cached.valid() && use_disk)
+        {
+            cached = DracoDecodeCache::readDisk(dos.cacheDir, key);
+            if (cached.valid())
             {
-                geometry->setTexCoordArray(0, index_uv0);
+                DecodedTreeRestorer restorer(dos.kdTree);
+                cached->accept(restorer);
+                stats.kdtree_ms += restorer.m_kdtree_ms;
             }
-            if (index_color->size() > 0)
+            if (cached.valid() && use_memory)
             {
-                geometry->setColorArray(index_color);
-                geometry->setColorBinding(osg::Geometry::BIND_PER_VERTEX);
+                stats.cache_evictions += m_cache.insert(key, cached.get());
+                cached = DracoDecodeCache::share(*cached);
             }
+        }
+        if (cached.valid())
+        {
+            stats.cache_hits += 1;
+            stats.publishRead(options);
+            return cached.get();
+        }
+        if (use_memory || use_disk) stats.cache_misses += 1;
 
-            if (index_vertex->size() > 0)
-            {
-                geometry->addPrimitiveSet(
-                    new osg::DrawArrays(osg::PrimitiveSet::POINTS, 0, index_vertex->size()));
+        ReadResult result = decodeBuffer(data, size, dos, stats);
+        if (!result.success()) return result;
 
-                //geode
-                osg::Geode* geode = new osg::Geode();
-                geode->addDrawable(geometry);
-                ret->addChild(geode);
-            }
+        if (use_disk && result.getNode())
+        {
+            DracoDecodeCache::writeDisk(dos.cacheDir, key, *result.getNode());
+        }
+        if (use_memory && result.getNode())
+        {
+            //the cache keeps the decoded nodes, the caller gets its own copy
+            stats.cache_evictions += m_cache.insert(key, result.getNode());
+            osg::ref_ptr<osg::Node> shared = DracoDecodeCache::share(*result.getNode());
+            result = ReadResult(shared.get());
         }
 
-        return ret;
+        stats.publishRead(options);
+        return result;
     }
 
     virtual WriteResult writeNode(const osg::Node& node, const std::string& fileName
@@ -496,19 +1022,394 @@ public:
 
         OSG_INFO << "Writing file " << fileName << std::endl;
 
+        //encode completely before the file is touched, a failed write keeps
+        //the file that was there instead of leaving an empty or partial one
+        std::ostringstream encoded(std::ios::out | std::ios::binary);
+        WriteResult result = writeNode(node, encoded, options);
+        if (!result.success()) return result;
 
-        DracoOptions draco_options;
-        //draco_options.is_point_cloud = true; //default is false
+        const std::string data = encoded.str();
+        osgDB::ofstream fout(fileName.c_str(), std::ios::out | std::ios::binary);
+        if (!fout)
+        {
+            OSG_WARN << "Failed to create the output file " << fileName << std::endl;
+            return WriteResult::ERROR_IN_WRITING_FILE;
+        }
+        fout.write(data.data(), data.size());
+        fout.close();
+        if (fout.fail())
+        {
+            OSG_WARN << "Failed to write the output file " << fileName << std::endl;
+            return WriteResult::ERROR_IN_WRITING_FILE;
+        }
+        return WriteResult::FILE_SAVED;
+    }
 
+    virtual WriteResult writeNode(const osg::Node& node, std::ostream& fout
+        , const Options* options = NULL) const
+    {
         //detect node is mesh or point cloud
         DarocOptionsStruct dos = parseOptions(options);
+        if (!dos.error.empty())
+        {
+            OSG_WARN << dos.error << std::endl;
+            return WriteResult(dos.error);
+        }
+
+        DracoOptions draco_options = dos.encoder;
         draco_options.is_point_cloud = dos.isPointCloud;
 
+        DracoStatistics stats;
+        WriteResult result;
+        if (dos.structured)
+        {
+            result = writeStructured(node, draco_options, dos.instanceHash, fout, stats);
+        }
+        else if (draco_options.is_point_cloud && dos.tilePoints > 0)
+        {
+            result = writeTiled(node, draco_options, dos.tilePoints, fout, stats);
+        }
+        else if (dos.lodLevels > 0)
+        {
+            result = writeLOD(node, draco_options, dos.lodLevels, fout, stats);
+        }
+        else if (dos.instancing)
+        {
+            result = writeInstanced(node, draco_options, dos.instanceHash, fout, stats);
+        }
+        else
+        {
+            result = writeFlat(node, draco_options, fout, stats);
+        }
+
+        if (result.success())
+        {
+            stats.publishWrite(options);
+        }
+        return result;
+    }
+
+private:
+
+    //decoded files shared by every read with draco_cache
+    mutable DracoDecodeCache m_cache;
+
+    //payloads already in a container, by Geometry and by content hash
+    struct PayloadCache
+    {
+        std::map<const osg::Geometry*, std::vector<int> > byPointer;
+        std::multimap<size_t, std::pair<GeometryData, int> > byContent[3];   //triangles, lines, points
+    };
+
+    //decode a draco payload or container into a new node tree
+    ReadResult decodeBuffer(const char* data, size_t size, const DarocOptionsStruct& dos,
+        DracoStatistics& stats) const
+    {
+        if (DracoContainer::isContainer(data, size))
+        {
+            return readContainer(data, size, dos, stats);
+        }
+
+        bool decoded = false;
+        osg::ref_ptr<osg::Geometry> geometry = decodeGeometry(data, size, dos, decoded, stats);
+        if (!decoded)
+        {
+            return ReadResult::ERROR_IN_READING_FILE;
+        }
+
+        osg::ref_ptr<osg::Group> ret = new osg::Group();
+        if (geometry.valid())
+        {
+            //geode
+            osg::Geode* geode = new osg::Geode();
+            geode->addDrawable(geometry);
+            ret->addChild(geode);
+        }
+        return ret.release();
+    }
+
+    //decode one draco payload, decoded is false if draco rejected the data.
+    //returns NULL for a valid payload without any vertices. point clouds are
+    //drawn with point_mode, GL_POINTS or GL_LINES
+    osg::Geometry* decodeGeometry(const char* data, size_t size, const DarocOptionsStruct& dos,
+        bool& decoded, DracoStatistics& stats, GLenum point_mode = GL_POINTS) const
+    {
+        decoded = false;
+
+        // Create a draco decoding buffer. Note that no data is copied in this step.
+        draco::DecoderBuffer buffer;
+        buffer.Init(data, size);
+
+        draco::CycleTimer timer;
+        // Decode the input data into a geometry.
+        std::unique_ptr<draco::PointCloud> pc;
+        draco::Mesh *mesh = nullptr;
+        const draco::EncodedGeometryType geom_type =
+            draco::GetEncodedGeometryType(&buffer);
+        if (geom_type == draco::TRIANGULAR_MESH) {
+            timer.Start();
+            std::unique_ptr<draco::Mesh> in_mesh = draco::DecodeMeshFromBuffer(&buffer);
+            timer.Stop();
+            if (in_mesh) {
+                mesh = in_mesh.get();
+                pc = std::move(in_mesh);
+            }
+        }
+        else if (geom_type == draco::POINT_CLOUD) {
+            // Failed to decode it as mesh, so let's try to decode it as a point cloud.
+            timer.Start();
+            pc = draco::DecodePointCloudFromBuffer(&buffer);
+            timer.Stop();
+        }
+
+        if (pc == nullptr)
+        {
+            OSG_WARN << "Failed to decode the input data." << std::endl;
+            return NULL;
+        }
+        decoded = true;
+        stats.decode_ms += timer.GetInMs();
+
+        osg::Timer_t conversion_start = osg::Timer::instance()->tick();
+        osg::ref_ptr<osg::Geometry> geometry = dracoToGeometry(pc.get(), mesh, dos, point_mode);
+        stats.conversion_ms += osg::Timer::instance()->delta_m(conversion_start, osg::Timer::instance()->tick());
+
+        //draco emits faces in its traversal order, once per load is cheaper than every frame
+        if (dos.optimize && geometry.valid() && mesh)
+        {
+            osg::Timer_t optimize_start = osg::Timer::instance()->tick();
+            VertexCacheOptimizer::optimize(*geometry);
+            stats.optimize_ms += osg::Timer::instance()->delta_m(optimize_start, osg::Timer::instance()->tick());
+
+            //reordering keeps the bounds
+            StoredBoundCallback* bound = dynamic_cast<StoredBoundCallback*>(geometry->getComputeBoundingBoxCallback());
+            if (bound && bound->m_positions) bound->track(geometry->getVertexArray());
+        }
+
+        //picking acceleration, osg::KdTree needs float positions
+        if (dos.kdTree && geometry.valid() && !dos.compactPositions)
+        {
+            osg::Timer_t kdtree_start = osg::Timer::instance()->tick();
+            osg::ref_ptr<osg::KdTree> kd_tree = new osg::KdTree();
+            osg::KdTree::BuildOptions build_options;
+            if (kd_tree->build(build_options, geometry.get())) geometry->setShape(kd_tree.get());
+            stats.kdtree_ms += osg::Timer::instance()->delta_m(kdtree_start, osg::Timer::instance()->tick());
+        }
+        stats.vertices += pc->num_points();
+        stats.faces += mesh ? mesh->num_faces() : 0;
+        stats.payloads += 1;
+        return geometry.release();
+    }
 
-        //
-        osg::ref_ptr<GeometryFlat> gf = new GeometryFlat();
-        (const_cast<osg::Node*>(&node))->accept(*gf);
+    //decoded draco geometry to an osg::Geometry, NULL without vertices
+    osg::Geometry* dracoToGeometry(const draco::PointCloud* pc, const draco::Mesh* mesh,
+        const DarocOptionsStruct& dos, GLenum point_mode = GL_POINTS) const
+    {
+        //get index attribute, one element per draco point, and its bounds
+        const size_t num_points = pc->num_points();
+        osg::BoundingBox bounds;
+        osg::ref_ptr<osg::Vec3Array> index_vertex = dracoAttributeToArray<osg::Vec3Array>(
+            pc->GetNamedAttribute(draco::GeometryAttribute::POSITION), num_points, &bounds);
+        if (index_vertex->empty()) return NULL;
+        if (mesh && mesh->num_faces() == 0) return NULL;
+
+        osg::ref_ptr<osg::Geometry> geometry = new osg::Geometry();
+        geometry->setVertexArray(index_vertex);
+        dracoAttributesToGeometry(*pc, *geometry, dos.attributes);
+
+        if (mesh && !dos.deindex)
+        {
+            //keep decoded points as-is and index them with the draco face list
+            geometry->addPrimitiveSet(dracoFacesToDrawElements(*mesh, index_vertex->size()));
+        }
+        else if (mesh)
+        {
+            // to raw, every per point array is expanded along the face corners
+            std::vector<unsigned int> corners;
+            corners.reserve(mesh->num_faces() * 3);
+            for (draco::FaceIndex i(0); i < mesh->num_faces(); ++i)
+            {
+                const draco::Mesh::Face& f = mesh->face(i);
+                corners.push_back(f[0].value());
+                corners.push_back(f[1].value());
+                corners.push_back(f[2].value());
+            }
 
+            geometry->setVertexArray(expandArray(geometry->getVertexArray(), corners));
+            geometry->setNormalArray(expandArray(geometry->getNormalArray(), corners));
+            geometry->setColorArray(expandArray(geometry->getColorArray(), corners));
+            for (unsigned int unit = 0; unit < geometry->getNumTexCoordArrays(); unit++)
+            {
+                geometry->setTexCoordArray(unit, expandArray(geometry->getTexCoordArray(unit), corners));
+            }
+            for (unsigned int index = 0; index < geometry->getNumVertexAttribArrays(); index++)
+            {
+                geometry->setVertexAttribArray(index, expandArray(geometry->getVertexAttribArray(index), corners));
+            }
+
+            //new triangles geometry
+            geometry->addPrimitiveSet(
+                new osg::DrawArrays(osg::PrimitiveSet::TRIANGLES, 0, corners.size()));
+        }
+        else if (point_mode == GL_LINES)
+        {
+            //line segments, two points per line
+            geometry->addPrimitiveSet(
+                new osg::DrawArrays(osg::PrimitiveSet::LINES, 0, index_vertex->size() & ~size_t(1)));
+        }
+        else
+        {
+            //new points geometry
+            geometry->addPrimitiveSet(
+                new osg::DrawArrays(osg::PrimitiveSet::POINTS, 0, index_vertex->size()));
+        }
+
+        compactGeometry(*geometry, dos, bounds);
+        return geometry.release();
+    }
+
+    //swap float arrays for the compact ones asked for in the options, the
+    //bounds of the decoded positions become the bounds of the Geometry
+    static void compactGeometry(osg::Geometry& geometry, const DarocOptionsStruct& dos,
+        const osg::BoundingBox& bounds)
+    {
+        if (dos.compact)
+        {
+            if (osg::Vec3Array* normal = dynamic_cast<osg::Vec3Array*>(geometry.getNormalArray()))
+            {
+                geometry.setNormalArray(compactNormals(*normal));
+            }
+            if (osg::Vec4Array* color = dynamic_cast<osg::Vec4Array*>(geometry.getColorArray()))
+            {
+                geometry.setColorArray(compactColors(*color));
+            }
+        }
+
+        osg::Vec3Array* vertex = dynamic_cast<osg::Vec3Array*>(geometry.getVertexArray());
+        if (!vertex) return;
+        if (!dos.compactPositions)
+        {
+            geometry.setComputeBoundingBoxCallback(new StoredBoundCallback(bounds, vertex));
+        }
+        else
+        {
+            osg::Vec3 scale, offset;
+            geometry.setVertexArray(compactPositions(*vertex, bounds, scale, offset));
+            geometry.setComputeBoundingBoxCallback(new StoredBoundCallback(bounds));
+
+            osg::StateSet* stateset = geometry.getOrCreateStateSet();
+            stateset->addUniform(new osg::Uniform("draco_position_scale", scale));
+            stateset->addUniform(new osg::Uniform("draco_position_offset", offset));
+        }
+    }
+
+    //container StateSet of a Geometry, merged with the dequantization
+    //uniforms of compact positions when the Geometry has them
+    static void setGeometryStateSet(osg::Geometry& geometry, osg::StateSet* stateset)
+    {
+        osg::StateSet* own = geometry.getStateSet();
+        osg::Uniform* scale = own ? own->getUniform("draco_position_scale") : NULL;
+        osg::Uniform* offset = own ? own->getUniform("draco_position_offset") : NULL;
+        if (!scale || !offset || own == stateset)
+        {
+            geometry.setStateSet(stateset);
+            return;
+        }
+
+        osg::ref_ptr<osg::StateSet> merged = stateset
+            ? new osg::StateSet(*stateset, osg::CopyOp::SHALLOW_COPY) : new osg::StateSet();
+        merged->addUniform(scale);
+        merged->addUniform(offset);
+        geometry.setStateSet(merged.get());
+    }
+
+    //normals, colors, every texture unit and generic attribute of a decoded
+    //point cloud as per vertex arrays, the first attribute of a slot wins.
+    //kinds missing from attributes are skipped
+    static void dracoAttributesToGeometry(const draco::PointCloud& pc, osg::Geometry& geometry,
+        unsigned int attributes)
+    {
+        const size_t num_points = pc.num_points();
+        for (int i = 0; i < pc.num_attributes(); i++)
+        {
+            const draco::PointAttribute* att = pc.attribute(i);
+            const unsigned int slot = att->custom_id();
+            switch (att->attribute_type())
+            {
+            case draco::GeometryAttribute::NORMAL:
+                if ((attributes & DRACO_READ_NORMAL) && !geometry.getNormalArray())
+                {
+                    osg::ref_ptr<osg::Vec3Array> normal = dracoAttributeToArray<osg::Vec3Array>(att, num_points);
+                    if (!normal->empty()) geometry.setNormalArray(normal, osg::Array::BIND_PER_VERTEX);
+                }
+                break;
+            case draco::GeometryAttribute::COLOR:
+                if ((attributes & DRACO_READ_COLOR) && !geometry.getColorArray())
+                {
+                    osg::ref_ptr<osg::Vec4Array> color = dracoAttributeToArray<osg::Vec4Array>(att, num_points);
+                    if (!color->empty()) geometry.setColorArray(color, osg::Array::BIND_PER_VERTEX);
+                }
+                break;
+            case draco::GeometryAttribute::TEX_COORD:
+                if ((attributes & DRACO_READ_TEXCOORD) && !geometry.getTexCoordArray(slot))
+                {
+                    osg::ref_ptr<osg::Vec2Array> uv = dracoAttributeToArray<osg::Vec2Array>(att, num_points);
+                    if (!uv->empty()) geometry.setTexCoordArray(slot, uv, osg::Array::BIND_PER_VERTEX);
+                }
+                break;
+            case draco::GeometryAttribute::GENERIC:
+                if ((attributes & DRACO_READ_GENERIC) && !geometry.getVertexAttribArray(slot))
+                {
+                    osg::ref_ptr<osg::Array> attrib;
+                    switch (att->components_count())
+                    {
+                    case 1: attrib = dracoAttributeToArray<osg::FloatArray>(att, num_points); break;
+                    case 2: attrib = dracoAttributeToArray<osg::Vec2Array>(att, num_points); break;
+                    case 3: attrib = dracoAttributeToArray<osg::Vec3Array>(att, num_points); break;
+                    default: attrib = dracoAttributeToArray<osg::Vec4Array>(att, num_points); break;
+                    }
+                    if (attrib->getNumElements() > 0) geometry.setVertexAttribArray(slot, attrib, osg::Array::BIND_PER_VERTEX);
+                }
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    //per point array gathered along face corners, NULL stays NULL
+    template<class ArrayT>
+    static ArrayT* expandArray(const ArrayT& array, const std::vector<unsigned int>& corners)
+    {
+        osg::ref_ptr<ArrayT> result = new ArrayT(corners.size());
+        for (size_t i = 0; i < corners.size(); i++)
+        {
+            (*result)[i] = array[corners[i]];
+        }
+        result->setBinding(array.getBinding());
+        result->setNormalize(array.getNormalize());
+        return result.release();
+    }
+
+    static osg::Array* expandArray(osg::Array* array, const std::vector<unsigned int>& corners)
+    {
+        if (!array) return NULL;
+        if (osg::FloatArray* a = dynamic_cast<osg::FloatArray*>(array)) return expandArray(*a, corners);
+        if (osg::Vec2Array* a = dynamic_cast<osg::Vec2Array*>(array)) return expandArray(*a, corners);
+        if (osg::Vec3Array* a = dynamic_cast<osg::Vec3Array*>(array)) return expandArray(*a, corners);
+        if (osg::Vec4Array* a = dynamic_cast<osg::Vec4Array*>(array)) return expandArray(*a, corners);
+        return array;
+    }
+
+    //flattened geometry to one draco mesh or point cloud written to fout
+    bool encodeGeometryData(const GeometryData& data, const DracoOptions& draco_options,
+        std::ostream& fout, DracoStatistics& stats) const
+    {
+        if (data.raw_vertex->empty())
+        {
+            OSG_WARN << "No vertices to encode." << std::endl;
+            return false;
+        }
 
         //pointCloud and mesh
         std::unique_ptr<draco::PointCloud> pc;
@@ -517,34 +1418,35 @@ public:
         {
             std::unique_ptr<draco::Mesh> out_mesh(new draco::Mesh());
 
-            //osg geomtry to draco
+            //osg geomtry to draco, one point per flattened vertex
 
-            int num_positions_ = gf->m_geomtry_data.raw_vertex->size();
-            int num_obj_faces_ = num_positions_ / 3;
+            int num_positions_ = data.raw_vertex->size();
+            int num_obj_faces_ = data.raw_index->size() / 3;
 
             // Initialize point cloud and mesh properties.
             out_mesh->SetNumFaces(num_obj_faces_);
             out_mesh->set_num_points(num_positions_);
 
-            osgNodeToDarocAttribute(gf, out_mesh.get());
+            osgNodeToDarocAttribute(data, out_mesh.get());
 
-            // Add faces with identity mapping between vertex and corner indices.
-            // Duplicate vertices will get removed later.
+            // Faces index the points directly, the attributes map them 1:1.
+            const unsigned int* index = static_cast<const unsigned int*>(data.raw_index->getDataPointer());
             draco::Mesh::Face face;
-            for (draco::FaceIndex i(0); i < num_obj_faces_; ++i)
+            for (draco::FaceIndex i(0); i < num_obj_faces_; ++i, index += 3)
             {
-                for (int c = 0; c < 3; ++c)
-                {
-                    face[c] = 3 * i.value() + c;
-                }
+                face[0] = index[0];
+                face[1] = index[1];
+                face[2] = index[2];
                 out_mesh->SetFace(i, face);
             }
 
-            //if (true/*deduplicate_input_values_*/) 
-            //{
-            out_mesh->DeduplicateAttributeValues();
-            //}
-            out_mesh->DeduplicatePointIds();
+            stats.points_before_dedup += out_mesh->num_points();
+            if (draco_options.deduplicate)
+            {
+                out_mesh->DeduplicateAttributeValues();
+                out_mesh->DeduplicatePointIds();
+            }
+            stats.points_after_dedup += out_mesh->num_points();
 
             mesh = out_mesh.get();
             pc = std::move(out_mesh);
@@ -556,18 +1458,23 @@ public:
             //osg points to draco
             pc = std::unique_ptr<draco::PointCloud>(new draco::PointCloud());
 
-            int num_positions_ = gf->m_geomtry_data.raw_vertex->size();
+            int num_positions_ = data.raw_vertex->size();
             pc->set_num_points(num_positions_);
 
-            osgNodeToDarocAttribute(gf, pc.get());
+            osgNodeToDarocAttribute(data, pc.get());
 
-            pc->DeduplicateAttributeValues();
-            pc->DeduplicatePointIds();
+            stats.points_before_dedup += pc->num_points();
+            if (draco_options.deduplicate && !draco_options.keep_point_order)
+            {
+                pc->DeduplicateAttributeValues();
+                pc->DeduplicatePointIds();
+            }
+            stats.points_after_dedup += pc->num_points();
 
             if (!pc)
             {
-                printf("Failed loading the input point cloud.\n");
-                return WriteResult::ERROR_IN_WRITING_FILE;
+                OSG_WARN << "Failed loading the input point cloud." << std::endl;
+                return false;
             }
         }
 
@@ -581,11 +1488,16 @@ public:
         }
         if (draco_options.tex_coords_quantization_bits > 0)
         {
-            draco::SetNamedAttributeQuantization(&encoder_options, *pc.get(),
-                draco::GeometryAttribute::TEX_COORD,
-                draco_options.tex_coords_quantization_bits);
+            //every texture unit, not only the first one
+            for (int i = 0; i < pc->num_attributes(); i++)
+            {
+                if (pc->attribute(i)->attribute_type() != draco::GeometryAttribute::TEX_COORD) continue;
+                draco::SetAttributeQuantization(&encoder_options, pc->attribute(i),
+                    draco_options.tex_coords_quantization_bits);
+            }
         }
-        if (draco_options.normals_quantization_bits > 0)
+        if (draco_options.normals_quantization_bits > 0
+            && pc->GetNamedAttributeId(draco::GeometryAttribute::NORMAL) >= 0)
         {
             draco::SetNamedAttributeQuantization(&encoder_options, *pc.get(),
                 draco::GeometryAttribute::NORMAL,
@@ -594,13 +1506,19 @@ public:
 
         // Convert compression level to speed (that 0 = slowest, 10 = fastest).
         const int speed = 10 - draco_options.compression_level;
-        draco::SetSpeedOptions(&encoder_options, speed, speed);
+        draco::SetSpeedOptions(&encoder_options,
+            draco_options.encode_speed >= 0 ? draco_options.encode_speed : speed,
+            draco_options.decode_speed >= 0 ? draco_options.decode_speed : speed);
 
-        if (draco_options.output.empty())
+        // Point clouds keep the draco default method, unless the kd-tree
+        // encoder must not reorder their points.
+        if (mesh && draco_options.encoding_method >= 0)
+        {
+            draco::SetEncodingMethod(&encoder_options, draco_options.encoding_method);
+        }
+        else if (!mesh && draco_options.keep_point_order)
         {
-            // Create a default output file by attaching .drc to the input file name.
-            //draco_options.output = draco_options.input + ".drc";
-            draco_options.output = fileName;
+            draco::SetEncodingMethod(&encoder_options, draco::POINT_CLOUD_SEQUENTIAL_ENCODING);
         }
 
         //is mesh
@@ -609,17 +1527,881 @@ public:
 
         PrintOptions(*pc.get(), draco_options);
 
-        if (is_mesh)
+        stats.vertices += pc->num_points();
+        stats.faces += is_mesh ? mesh->num_faces() : 0;
+        stats.payloads += 1;
+
+        int status = is_mesh
+            ? EncodeMeshToStream(*mesh, encoder_options, fout, stats)
+            : EncodePointCloudToStream(*pc.get(), encoder_options, fout, stats);
+        return status == 0;
+    }
+
+    //decode container payloads on draco_threads workers, each into
+    //geometries[payload]. decode and conversion times are summed over threads.
+    //returns the number of payloads draco rejected
+    size_t decodePayloads(const DracoContainer& container, const std::vector<int>& payloads,
+        const DarocOptionsStruct& dos, std::vector<osg::ref_ptr<osg::Geometry> >& geometries,
+        DracoStatistics& stats) const
+    {
+        std::vector<DracoStatistics> payload_stats(payloads.size());
+        std::vector<char> payload_decoded(payloads.size(), 0);
+        std::atomic<size_t> next(0);
+        auto decode_payloads = [&]()
+        {
+            for (size_t p = next++; p < payloads.size(); p = next++)
+            {
+                const int payload = payloads[p];
+                bool decoded = false;
+                geometries[payload] = decodeGeometry(container.getBlobData(payload),
+                    container.getBlobSize(payload), dos, decoded, payload_stats[p],
+                    container.getBlobType(payload) == DRACO_BLOB_LINES ? GL_LINES : GL_POINTS);
+                payload_decoded[p] = decoded ? 1 : 0;
+            }
+        };
+
+        const size_t num_threads = std::min<size_t>(payloads.size(), dos.encoder.num_threads > 0
+            ? dos.encoder.num_threads : std::max(1u, std::thread::hardware_concurrency()));
+        std::vector<std::thread> threads;
+        for (size_t t = 1; t < num_threads; t++) threads.push_back(std::thread(decode_payloads));
+        decode_payloads();
+        for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+
+        size_t failed = 0;
+        for (size_t p = 0; p < payloads.size(); p++)
         {
-            EncodeMeshToFile(*mesh, encoder_options, draco_options.output);
+            stats.add(payload_stats[p]);
+            if (!payload_decoded[p]) failed++;
         }
-        else
+        return failed;
+    }
+
+    //nodes below the skip finest children of every LOD node, at least one
+    //level is kept. range_min extends the finest kept level down to distance 0
+    static std::vector<bool> skippedLevels(const DracoContainer& container, int skip,
+        std::vector<float>& range_min)
+    {
+        const size_t num_nodes = container.getNumNodes();
+        std::vector<bool> skipped(num_nodes, false);
+        std::vector<std::vector<size_t> > levels(num_nodes);
+        range_min.resize(num_nodes);
+        for (size_t i = 0; i < num_nodes; i++)
+        {
+            const DracoContainerNode& record = container.getNode(i);
+            range_min[i] = record.range[0];
+            if (record.parent >= 0 && container.getNode(record.parent).type == DRACO_NODE_LOD)
+            {
+                levels[record.parent].push_back(i);
+            }
+        }
+
+        for (size_t i = 0; i < num_nodes && skip > 0; i++)
+        {
+            std::vector<size_t>& children = levels[i];
+            if (children.empty()) continue;
+
+            std::sort(children.begin(), children.end(),
+                [&range_min](size_t a, size_t b) { return range_min[a] < range_min[b]; });
+            const size_t drop = std::min<size_t>(skip, children.size() - 1);
+            for (size_t c = 0; c < drop; c++) skipped[children[c]] = true;
+            range_min[children[drop]] = range_min[children[0]];
+        }
+
+        for (size_t i = 0; i < num_nodes; i++)
+        {
+            const int parent = container.getNode(i).parent;
+            if (parent >= 0 && skipped[parent]) skipped[i] = true;
+        }
+        return skipped;
+    }
+
+    //the levels of every LOD node except its coarsest one, coarse to fine,
+    //the order the database pager reads them in
+    static std::vector<std::vector<size_t> > deferredLevels(const DracoContainer& container,
+        const std::vector<bool>& skipped, const std::vector<float>& range_min)
+    {
+        const size_t num_nodes = container.getNumNodes();
+        std::vector<std::vector<size_t> > levels(num_nodes);
+        for (size_t i = 0; i < num_nodes; i++)
+        {
+            const DracoContainerNode& record = container.getNode(i);
+            if (!skipped[i] && record.parent >= 0 && container.getNode(record.parent).type == DRACO_NODE_LOD)
+            {
+                levels[record.parent].push_back(i);
+            }
+        }
+
+        for (size_t i = 0; i < num_nodes; i++)
+        {
+            std::vector<size_t>& children = levels[i];
+            if (children.empty()) continue;
+
+            std::sort(children.begin(), children.end(),
+                [&range_min](size_t a, size_t b) { return range_min[a] > range_min[b]; });
+            children.erase(children.begin());
+        }
+        return levels;
+    }
+
+    //rebuild the node tree stored in a container
+    ReadResult readContainer(const char* data, size_t size, const DarocOptionsStruct& dos,
+        DracoStatistics& stats) const
+    {
+        DracoContainer container;
+        if (!container.read(data, size))
+        {
+            OSG_WARN << "Invalid draco container." << std::endl;
+            return ReadResult::ERROR_IN_READING_FILE;
+        }
+
+        osg::ref_ptr<osg::Group> ret = new osg::Group();
+        std::vector<osg::ref_ptr<osg::Object> > objects(container.getNumNodes());
+        std::vector<osg::ref_ptr<osg::StateSet> > statesets(container.getNumBlobs());
+        std::vector<osg::ref_ptr<osg::Geometry> > geometries(container.getNumBlobs());
+        std::vector<osg::StateSet*> geometry_statesets(container.getNumBlobs(), NULL);
+        std::vector<bool> geometry_used(container.getNumBlobs(), false);
+
+        std::vector<float> range_min;
+        std::vector<bool> skipped = skippedLevels(container, dos.lodSkip, range_min);
+        const size_t num_nodes = container.getNumNodes();
+
+        //a paged level, only its node and the nodes below it
+        if (dos.subtreeRoot >= 0)
+        {
+            if (dos.subtreeRoot >= static_cast<int>(num_nodes))
+            {
+                OSG_WARN << "Invalid draco LOD level " << dos.subtreeRoot << "." << std::endl;
+                return ReadResult::ERROR_IN_READING_FILE;
+            }
+            std::vector<bool> inside(num_nodes, false);
+            for (size_t i = 0; i < num_nodes; i++)
+            {
+                const int parent = container.getNode(i).parent;
+                inside[i] = static_cast<int>(i) == dos.subtreeRoot || (parent >= 0 && inside[parent]);
+                if (!inside[i]) skipped[i] = true;
+            }
+        }
+
+        //paged, every LOD keeps its coarsest level and the finer ones are left
+        //to the database pager. they are neither decoded nor built here
+        std::vector<std::vector<size_t> > deferred;
+        if (dos.lodPaged && !dos.sourceFile.empty() && dos.subtreeRoot < 0)
+        {
+            deferred = deferredLevels(container, skipped, range_min);
+            std::vector<bool> below(num_nodes, false);
+            for (size_t i = 0; i < num_nodes; i++)
+            {
+                for (size_t l = 0; l < deferred[i].size(); l++) below[deferred[i][l]] = true;
+            }
+            for (size_t i = 0; i < num_nodes; i++)
+            {
+                const int parent = container.getNode(i).parent;
+                if (parent >= 0 && below[parent]) below[i] = true;
+                if (below[i]) skipped[i] = true;
+            }
+        }
+
+        //payloads are independent, decode them all before building the tree
+        std::vector<int> payloads;
+        std::vector<bool> listed(container.getNumBlobs(), false);
+        for (size_t i = 0; i < container.getNumNodes(); i++)
+        {
+            const DracoContainerNode& record = container.getNode(i);
+            if (skipped[i]) continue;
+            if (record.type == DRACO_NODE_GEOMETRY && record.payload >= 0 && !listed[record.payload])
+            {
+                listed[record.payload] = true;
+                payloads.push_back(record.payload);
+            }
+        }
+        //a payload draco rejects would leave a hole in the scene, fail like a
+        //single payload file does
+        const size_t failed = decodePayloads(container, payloads, dos, geometries, stats);
+        if (failed > 0)
+        {
+            OSG_WARN << "Failed to decode " << failed << " of " << payloads.size()
+                << " draco container payloads." << std::endl;
+            return ReadResult::ERROR_IN_READING_FILE;
+        }
+
+        for (size_t i = 0; i < container.getNumNodes(); i++)
+        {
+            const DracoContainerNode& record = container.getNode(i);
+            if (skipped[i]) continue;
+
+            osg::StateSet* stateset = NULL;
+            if (record.stateset >= 0)
+            {
+                osg::ref_ptr<osg::StateSet>& cached = statesets[record.stateset];
+                if (!cached.valid())
+                {
+                    cached = blobToStateSet(container.getBlobData(record.stateset),
+                        container.getBlobSize(record.stateset));
+                }
+                stateset = cached.get();
+            }
+
+            osg::ref_ptr<osg::Object> object;
+            switch (record.type)
+            {
+            case DRACO_NODE_MATRIX_TRANSFORM:
+                object = new osg::MatrixTransform(osg::Matrixd(record.matrix));
+                break;
+            case DRACO_NODE_GEODE:
+                object = new osg::Geode();
+                break;
+            case DRACO_NODE_LOD:
+                if (i < deferred.size() && !deferred[i].empty()) object = new osg::PagedLOD();
+                else object = new osg::LOD();
+                break;
+            case DRACO_NODE_TILE:
+                //every chunk is decoded and attached, osg computes the tile
+                //bound from them. the stored bounds are for paging readers
+                object = new osg::Group();
+                break;
+            case DRACO_NODE_GEOMETRY:
+                if (record.payload >= 0)
+                {
+                    //instances of one payload share the decoded Geometry, or
+                    //at least its arrays when their StateSets differ
+                    osg::ref_ptr<osg::Geometry>& shared = geometries[record.payload];
+                    if (!geometry_used[record.payload])
+                    {
+                        if (shared.valid()) setGeometryStateSet(*shared, stateset);
+                        geometry_statesets[record.payload] = stateset;
+                        geometry_used[record.payload] = true;
+                    }
+                    if (shared.valid() && geometry_statesets[record.payload] != stateset)
+                    {
+                        osg::ref_ptr<osg::Geometry> copy = new osg::Geometry(*shared, osg::CopyOp::SHALLOW_COPY);
+                        setGeometryStateSet(*copy, stateset);
+                        object = copy.get();
+                    }
+                    else
+                    {
+                        object = shared.get();
+                    }
+                }
+                break;
+            default:
+                object = new osg::Group();
+                break;
+            }
+            if (!object.valid()) continue;
+            objects[i] = object;
+
+            object->setName(record.name);
+
+            //Geometry got their StateSet above
+            osg::Drawable* drawable = dynamic_cast<osg::Drawable*>(object.get());
+            if (!drawable)
+            {
+                if (osg::Node* node = dynamic_cast<osg::Node*>(object.get())) node->setStateSet(stateset);
+            }
+
+            //attach to the parent, nodes are stored parents first. a paged
+            //level is the root of its own tree
+            osg::Object* parent = record.parent >= 0 && static_cast<int>(i) != dos.subtreeRoot
+                ? objects[record.parent].get() : ret.get();
+            osg::Geode* geode = dynamic_cast<osg::Geode*>(parent);
+            if (geode && drawable)
+            {
+                geode->addDrawable(drawable);
+            }
+            else if (osg::LOD* lod = dynamic_cast<osg::LOD*>(parent))
+            {
+                if (osg::Node* node = dynamic_cast<osg::Node*>(object.get())) lod->addChild(node, range_min[i], record.range[1]);
+            }
+            else if (osg::Group* group = dynamic_cast<osg::Group*>(parent))
+            {
+                if (osg::Node* node = dynamic_cast<osg::Node*>(object.get())) group->addChild(node);
+            }
+        }
+
+        //the finer levels as external children after the coarsest one. the
+        //pager reads the next one once the view comes into its range, the
+        //finest level read so far is shown until then
+        for (size_t i = 0; i < deferred.size(); i++)
+        {
+            osg::PagedLOD* plod = dynamic_cast<osg::PagedLOD*>(objects[i].get());
+            if (!plod) continue;
+
+            plod->setDatabaseOptions(const_cast<osgDB::ReaderWriter::Options*>(dos.readOptions));
+            for (size_t l = 0; l < deferred[i].size(); l++)
+            {
+                const size_t level = deferred[i][l];
+                const unsigned int child = plod->getNumFileNames();
+                std::ostringstream level_file;
+                level_file << dos.sourceFile << "." << level << ".drclevel";
+                plod->setFileName(child, level_file.str());
+                plod->setRange(child, range_min[level], container.getNode(level).range[1]);
+            }
+        }
+
+        //a single root is returned as-is
+        if (ret->getNumChildren() == 1)
+        {
+            return ret->getChild(0);
+        }
+        return ret.release();
+    }
+
+    //one draco payload per Geometry, the hierarchy and StateSets go into the container header
+    WriteResult writeStructured(const osg::Node& node, const DracoOptions& draco_options,
+        bool by_content, std::ostream& fout, DracoStatistics& stats) const
+    {
+        GeometryStructure gs;
+        (const_cast<osg::Node*>(&node))->accept(gs);
+
+        DracoContainer container;
+        PayloadCache payloads;
+        std::map<const osg::StateSet*, int> stateset_blobs;
+
+        //a Geometry can take up to three container nodes
+        std::vector<int> node_index(gs.m_entries.size(), -1);
+        for (size_t i = 0; i < gs.m_entries.size(); i++)
+        {
+            const StructureEntry& entry = gs.m_entries[i];
+
+            DracoContainerNode record;
+            record.parent = entry.parent >= 0 ? node_index[entry.parent] : -1;
+            record.type = entry.type;
+            record.name = entry.name;
+            memcpy(record.matrix, entry.matrix.ptr(), sizeof(record.matrix));
+
+            if (entry.stateset)
+            {
+                std::map<const osg::StateSet*, int>::iterator itr = stateset_blobs.find(entry.stateset);
+                if (itr == stateset_blobs.end())
+                {
+                    std::string blob = stateSetToBlob(*entry.stateset);
+                    int index = blob.empty() ? -1 : container.addBlob(DRACO_BLOB_STATESET, blob);
+                    itr = stateset_blobs.insert(std::make_pair(entry.stateset, index)).first;
+                }
+                record.stateset = itr->second;
+            }
+
+            //one node per payload, the triangles, lines and points of the
+            //Geometry. one without payload for a Geometry without vertices
+            std::vector<int> indices;
+            if (entry.geometry && !geometryPayloads(*entry.geometry, draco_options, by_content,
+                payloads, container, stats, indices))
+            {
+                return WriteResult::ERROR_IN_WRITING_FILE;
+            }
+            if (indices.empty()) indices.push_back(-1);
+
+            for (size_t p = 0; p < indices.size(); p++)
+            {
+                record.payload = indices[p];
+                node_index[i] = container.addNode(record);
+            }
+        }
+
+        if (!container.write(fout))
+        {
+            OSG_WARN << "Failed to write the draco container." << std::endl;
+            return WriteResult::ERROR_IN_WRITING_FILE;
+        }
+        return WriteResult::FILE_SAVED;
+    }
+
+    //flat output, except that a Geometry reached through several transforms
+    //is encoded once and referenced from one MatrixTransform per instance
+    WriteResult writeInstanced(const osg::Node& node, const DracoOptions& draco_options,
+        bool by_content, std::ostream& fout, DracoStatistics& stats) const
+    {
+        GeometryCollector gc;
+        (const_cast<osg::Node*>(&node))->accept(gc);
+
+        //with by_content, content identical Geometry maps to the first one seen
+        std::map<osg::Geometry*, osg::Geometry*> canonical;
+        std::multimap<size_t, std::pair<GeometryData, osg::Geometry*> > by_hash;
+        for (size_t i = 0; i < gc.m_instances.size(); i++)
+        {
+            osg::Geometry* geometry = gc.m_instances[i].geometry;
+            if (canonical.count(geometry)) continue;
+            canonical[geometry] = geometry;
+            if (!by_content) continue;
+
+            GeometryFlat gf;
+            gf.processGeomatry(*geometry, osg::Matrix::identity());
+            size_t hash = hashGeometryData(gf.m_geomtry_data);
+
+            typedef std::multimap<size_t, std::pair<GeometryData, osg::Geometry*> >::iterator HashItr;
+            std::pair<HashItr, HashItr> range = by_hash.equal_range(hash);
+            for (HashItr hitr = range.first; hitr != range.second; ++hitr)
+            {
+                if (equalGeometryData(hitr->second.first, gf.m_geomtry_data))
+                {
+                    canonical[geometry] = hitr->second.second;
+                    break;
+                }
+            }
+            if (canonical[geometry] == geometry)
+            {
+                by_hash.insert(std::make_pair(hash, std::make_pair(gf.m_geomtry_data, geometry)));
+            }
+        }
+
+        std::map<const osg::Geometry*, unsigned int> use_count;
+        for (size_t i = 0; i < gc.m_instances.size(); i++)
+        {
+            use_count[canonical[gc.m_instances[i].geometry]]++;
+        }
+
+        DracoContainer container;
+        PayloadCache payloads;
+
+        DracoContainerNode root;
+        int root_index = container.addNode(root);
+
+        //instanced geometry, everything else is merged below
+        std::vector<GeometryInstance> single;
+        unsigned int num_instances = 0;
+        for (size_t i = 0; i < gc.m_instances.size(); i++)
+        {
+            const GeometryInstance& instance = gc.m_instances[i];
+            osg::Geometry* shared = canonical[instance.geometry];
+            if (use_count[shared] < 2)
+            {
+                single.push_back(instance);
+                continue;
+            }
+
+            std::vector<int> indices;
+            if (!geometryPayloads(*shared, draco_options, false, payloads, container, stats, indices))
+            {
+                return WriteResult::ERROR_IN_WRITING_FILE;
+            }
+            if (indices.empty()) continue;
+
+            DracoContainerNode transform;
+            transform.parent = root_index;
+            transform.type = DRACO_NODE_MATRIX_TRANSFORM;
+            memcpy(transform.matrix, instance.matrix.ptr(), sizeof(transform.matrix));
+
+            DracoContainerNode geode;
+            geode.parent = container.addNode(transform);
+            geode.type = DRACO_NODE_GEODE;
+
+            DracoContainerNode geometry;
+            geometry.parent = container.addNode(geode);
+            geometry.type = DRACO_NODE_GEOMETRY;
+            for (size_t p = 0; p < indices.size(); p++)
+            {
+                geometry.payload = indices[p];
+                container.addNode(geometry);
+            }
+            num_instances++;
+        }
+
+        //the rest merged like writeFlat, with its lines and points
+        GeometryFlat merged(draco_options.is_point_cloud, draco_options.num_threads);
+        GeometryFlat lines(false, draco_options.num_threads, GL_LINES);
+        GeometryFlat points(false, draco_options.num_threads, GL_POINTS);
+        merged.flatten(single);
+        if (!draco_options.is_point_cloud)
         {
-            EncodePointCloudToFile(*pc.get(), encoder_options, draco_options.output);
+            lines.flatten(single);
+            points.flatten(single);
+        }
+        const GeometryData* parts[3] = { &merged.m_geomtry_data, &lines.m_geomtry_data, &points.m_geomtry_data };
+        if (!addPrimitiveGeode(parts, draco_options, root_index, container, stats))
+        {
+            return WriteResult::ERROR_IN_WRITING_FILE;
+        }
+
+        OSG_INFO << "Instancing: " << num_instances << " instances of "
+            << container.getNumBlobs() << " payloads" << std::endl;
+
+        if (!container.write(fout))
+        {
+            OSG_WARN << "Failed to write the draco container." << std::endl;
+            return WriteResult::ERROR_IN_WRITING_FILE;
+        }
+        return WriteResult::FILE_SAVED;
+    }
+
+    //point cloud split into an octree of chunks, each chunk is its own draco
+    //payload encoded on the worker threads, tiles keep their bounds
+    WriteResult writeTiled(const osg::Node& node, const DracoOptions& draco_options,
+        int tile_points, std::ostream& fout, DracoStatistics& stats) const
+    {
+        osg::Timer_t flatten_start = osg::Timer::instance()->tick();
+        GeometryFlat gf(true, draco_options.num_threads);
+        gf.flatten(const_cast<osg::Node&>(node));
+        const GeometryData& data = gf.m_geomtry_data;
+
+        PointOctree octree;
+        octree.build(*data.raw_vertex, tile_points);
+        stats.flatten_ms += osg::Timer::instance()->delta_m(flatten_start, osg::Timer::instance()->tick());
+
+        if (octree.m_nodes.empty())
+        {
+            OSG_WARN << "No vertices to encode." << std::endl;
+            return WriteResult::ERROR_IN_WRITING_FILE;
+        }
+
+        std::vector<size_t> leaves;
+        for (size_t i = 0; i < octree.m_nodes.size(); i++)
+        {
+            if (octree.m_nodes[i].leaf) leaves.push_back(i);
+        }
+
+        //encode the leaves in parallel, results are merged in octree order
+        std::vector<std::string> payloads(leaves.size());
+        std::vector<DracoStatistics> leaf_stats(leaves.size());
+        std::atomic<bool> failed(false);
+        std::atomic<size_t> next(0);
+        auto encode_leaves = [&]()
+        {
+            for (size_t l = next++; l < leaves.size(); l = next++)
+            {
+                const PointOctree::Node& leaf = octree.m_nodes[leaves[l]];
+                GeometryData chunk = gatherGeometryData(data, &octree.m_order[leaf.begin], leaf.end - leaf.begin);
+
+                std::ostringstream payload(std::ios::out | std::ios::binary);
+                if (!encodeGeometryData(chunk, draco_options, payload, leaf_stats[l]))
+                {
+                    failed = true;
+                    continue;
+                }
+                payloads[l] = payload.str();
+            }
+        };
+
+        const size_t num_threads = std::min<size_t>(leaves.size(), draco_options.num_threads > 0
+            ? draco_options.num_threads : std::max(1u, std::thread::hardware_concurrency()));
+        std::vector<std::thread> threads;
+        for (size_t t = 1; t < num_threads; t++) threads.push_back(std::thread(encode_leaves));
+        encode_leaves();
+        for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+
+        for (size_t l = 0; l < leaves.size(); l++) stats.add(leaf_stats[l]);
+        if (failed) return WriteResult::ERROR_IN_WRITING_FILE;
+
+        //one tile per octree node, leaves get a geode with their geometry
+        DracoContainer container;
+        std::vector<int> tile_index(octree.m_nodes.size(), -1);
+        size_t leaf_count = 0;
+        for (size_t i = 0; i < octree.m_nodes.size(); i++)
+        {
+            const PointOctree::Node& octree_node = octree.m_nodes[i];
+
+            DracoContainerNode tile;
+            tile.parent = octree_node.parent >= 0 ? tile_index[octree_node.parent] : -1;
+            tile.type = DRACO_NODE_TILE;
+            tile.bounds[0] = octree_node.bounds.xMin();
+            tile.bounds[1] = octree_node.bounds.yMin();
+            tile.bounds[2] = octree_node.bounds.zMin();
+            tile.bounds[3] = octree_node.bounds.xMax();
+            tile.bounds[4] = octree_node.bounds.yMax();
+            tile.bounds[5] = octree_node.bounds.zMax();
+            tile_index[i] = container.addNode(tile);
+            if (!octree_node.leaf) continue;
+
+            DracoContainerNode geode;
+            geode.parent = tile_index[i];
+            geode.type = DRACO_NODE_GEODE;
+
+            DracoContainerNode geometry;
+            geometry.parent = container.addNode(geode);
+            geometry.type = DRACO_NODE_GEOMETRY;
+            geometry.payload = container.addBlob(DRACO_BLOB_GEOMETRY, payloads[leaf_count++]);
+            container.addNode(geometry);
         }
 
+        OSG_INFO << "Tiled: " << data.raw_vertex->size() << " points in " << leaves.size()
+            << " chunks of " << octree.m_nodes.size() << " tiles" << std::endl;
+
+        if (!container.write(fout))
+        {
+            OSG_WARN << "Failed to write the draco container." << std::endl;
+            return WriteResult::ERROR_IN_WRITING_FILE;
+        }
         return WriteResult::FILE_SAVED;
     }
+
+    //every Geometry merged into one payload. in mesh mode lines and points
+    //are flattened separately and stored next to the mesh in a container
+    WriteResult writeFlat(const osg::Node& node, const DracoOptions& draco_options,
+        std::ostream& fout, DracoStatistics& stats) const
+    {
+        osg::Timer_t flatten_start = osg::Timer::instance()->tick();
+        GeometryFlat triangles(draco_options.is_point_cloud, draco_options.num_threads);
+        GeometryFlat lines(false, draco_options.num_threads, GL_LINES);
+        GeometryFlat points(false, draco_options.num_threads, GL_POINTS);
+        triangles.flatten(const_cast<osg::Node&>(node));
+        if (!draco_options.is_point_cloud)
+        {
+            lines.flatten(const_cast<osg::Node&>(node));
+            points.flatten(const_cast<osg::Node&>(node));
+        }
+        stats.flatten_ms += osg::Timer::instance()->delta_m(flatten_start, osg::Timer::instance()->tick());
+
+        //meshes only, the plain draco file as before
+        if (lines.m_geomtry_data.raw_index->empty() && points.m_geomtry_data.raw_index->empty())
+        {
+            return encodeGeometryData(triangles.m_geomtry_data, draco_options, fout, stats)
+                ? WriteResult::FILE_SAVED : WriteResult::ERROR_IN_WRITING_FILE;
+        }
+
+        DracoContainer container;
+        const GeometryData* parts[3] = { &triangles.m_geomtry_data, &lines.m_geomtry_data, &points.m_geomtry_data };
+        if (!addPrimitiveGeode(parts, draco_options, -1, container, stats))
+        {
+            return WriteResult::ERROR_IN_WRITING_FILE;
+        }
+
+        if (!container.write(fout))
+        {
+            OSG_WARN << "Failed to write the draco container." << std::endl;
+            return WriteResult::ERROR_IN_WRITING_FILE;
+        }
+        return WriteResult::FILE_SAVED;
+    }
+
+    //flattened triangles, lines and points stored as one geode below parent
+    //with a payload per part, parts without primitives or NULL are left out.
+    //false when encoding failed
+    bool addPrimitiveGeode(const GeometryData* const parts[3], const DracoOptions& draco_options, int parent,
+        DracoContainer& container, DracoStatistics& stats) const
+    {
+        const GLenum modes[3] = { GL_TRIANGLES, GL_LINES, GL_POINTS };
+        int geode_index = -1;
+        for (int i = 0; i < 3; i++)
+        {
+            if (!parts[i] || !hasPrimitives(*parts[i], modes[i], draco_options)) continue;
+
+            GeometryData data;
+            DracoOptions options;
+            uint32_t blob_type = primitivePayload(*parts[i], modes[i], draco_options, data, options);
+
+            std::ostringstream payload(std::ios::out | std::ios::binary);
+            if (!encodeGeometryData(data, options, payload, stats)) return false;
+
+            if (geode_index < 0)
+            {
+                DracoContainerNode geode;
+                geode.parent = parent;
+                geode.type = DRACO_NODE_GEODE;
+                geode_index = container.addNode(geode);
+            }
+
+            DracoContainerNode geometry;
+            geometry.parent = geode_index;
+            geometry.type = DRACO_NODE_GEOMETRY;
+            geometry.payload = container.addBlob(blob_type, payload.str());
+            container.addNode(geometry);
+        }
+        return true;
+    }
+
+    //a point cloud has its vertices but no index
+    static bool hasPrimitives(const GeometryData& flat, GLenum mode, const DracoOptions& draco_options)
+    {
+        return draco_options.is_point_cloud && mode == GL_TRIANGLES
+            ? !flat.raw_vertex->empty() : !flat.raw_index->empty();
+    }
+
+    //what to encode for flattened primitives of one mode and the blob type.
+    //lines become a point cloud with the two points of every line in order,
+    //points a point cloud of the points
+    static uint32_t primitivePayload(const GeometryData& flat, GLenum mode, const DracoOptions& draco_options,
+        GeometryData& data, DracoOptions& options)
+    {
+        options = draco_options;
+        if (mode == GL_LINES)
+        {
+            const osg::UIntArray& index = *flat.raw_index;
+            data = gatherGeometryData(flat, index.empty() ? NULL : &index[0], index.size());
+            options.is_point_cloud = true;
+            options.keep_point_order = true;
+            return DRACO_BLOB_LINES;
+        }
+
+        data = flat;
+        if (mode == GL_POINTS) options.is_point_cloud = true;
+        return DRACO_BLOB_GEOMETRY;
+    }
+
+    //the full level plus up to levels coarser ones from vertex clustering,
+    //each with 2 quantization bits less. draco_lod_paged reads the coarsest
+    //level first and the finer ones through the database pager, otherwise
+    //all levels are decoded on read. lines and points are not clustered,
+    //in mesh mode they are stored once next to the LOD at full detail
+    WriteResult writeLOD(const osg::Node& node, const DracoOptions& draco_options,
+        int levels, std::ostream& fout, DracoStatistics& stats) const
+    {
+        osg::Timer_t flatten_start = osg::Timer::instance()->tick();
+        GeometryFlat gf(draco_options.is_point_cloud, draco_options.num_threads);
+        GeometryFlat lines(false, draco_options.num_threads, GL_LINES);
+        GeometryFlat points(false, draco_options.num_threads, GL_POINTS);
+        gf.flatten(const_cast<osg::Node&>(node));
+        if (!draco_options.is_point_cloud)
+        {
+            lines.flatten(const_cast<osg::Node&>(node));
+            points.flatten(const_cast<osg::Node&>(node));
+        }
+
+        //256, 64, 16, 4 cells per axis, a mesh level without triangles ends the chain
+        std::vector<GeometryData> level_data(1, gf.m_geomtry_data);
+        for (int level = 1; level <= levels; level++)
+        {
+            GeometryData coarse = clusterGeometryData(gf.m_geomtry_data, 1024u >> (2 * level));
+            if (!draco_options.is_point_cloud && coarse.raw_index->empty()) break;
+            level_data.push_back(coarse);
+        }
+        stats.flatten_ms += osg::Timer::instance()->delta_m(flatten_start, osg::Timer::instance()->tick());
+
+        //only lines and points, nothing to build levels from
+        if (!draco_options.is_point_cloud && gf.m_geomtry_data.raw_index->empty())
+        {
+            return writeFlat(node, draco_options, fout, stats);
+        }
+
+        const osg::Vec3Array& vertices = *gf.m_geomtry_data.raw_vertex;
+        osg::BoundingBox bb;
+        for (size_t i = 0; i < vertices.size(); i++) bb.expandBy(vertices[i]);
+        const float radius = std::max(bb.radius(), std::numeric_limits<float>::min());
+
+        DracoContainer container;
+        DracoContainerNode lod;
+        lod.type = DRACO_NODE_LOD;
+        const bool extra = !lines.m_geomtry_data.raw_index->empty() || !points.m_geomtry_data.raw_index->empty();
+        if (extra)
+        {
+            //a group holding the LOD and the lines and points
+            lod.parent = container.addNode(DracoContainerNode());
+            const GeometryData* parts[3] = { NULL, &lines.m_geomtry_data, &points.m_geomtry_data };
+            if (!addPrimitiveGeode(parts, draco_options, lod.parent, container, stats))
+            {
+                return WriteResult::ERROR_IN_WRITING_FILE;
+            }
+        }
+        const int lod_index = container.addNode(lod);
+
+        //level l is shown from 4r * 2^(l - 1) to 4r * 2^l, the coarsest up to infinity
+        const int coarsest = static_cast<int>(level_data.size()) - 1;
+        for (int level = coarsest; level >= 0; level--)
+        {
+            DracoOptions level_options = draco_options;
+            level_options.pos_quantization_bits = coarserBits(draco_options.pos_quantization_bits, level);
+            level_options.tex_coords_quantization_bits = coarserBits(draco_options.tex_coords_quantization_bits, level);
+            level_options.normals_quantization_bits = coarserBits(draco_options.normals_quantization_bits, level);
+
+            std::ostringstream payload(std::ios::out | std::ios::binary);
+            if (!encodeGeometryData(level_data[level], level_options, payload, stats))
+            {
+                return WriteResult::ERROR_IN_WRITING_FILE;
+            }
+
+            DracoContainerNode geode;
+            geode.parent = lod_index;
+            geode.type = DRACO_NODE_GEODE;
+            geode.range[0] = level == 0 ? 0.0f : 4.0f * radius * (1 << (level - 1));
+            geode.range[1] = level == coarsest ? std::numeric_limits<float>::max() : 4.0f * radius * (1 << level);
+
+            DracoContainerNode geometry;
+            geometry.parent = container.addNode(geode);
+            geometry.type = DRACO_NODE_GEOMETRY;
+            geometry.payload = container.addBlob(DRACO_BLOB_GEOMETRY, payload.str());
+            container.addNode(geometry);
+        }
+
+        OSG_INFO << "LOD: " << level_data.size() << " levels" << std::endl;
+
+        if (!container.write(fout))
+        {
+            OSG_WARN << "Failed to write the draco container." << std::endl;
+            return WriteResult::ERROR_IN_WRITING_FILE;
+        }
+        return WriteResult::FILE_SAVED;
+    }
+
+    //quantization of a coarse level, never below 6 bits unless it was already
+    static int coarserBits(int bits, int level)
+    {
+        return bits > 0 ? std::max(bits - 2 * level, std::min(bits, 6)) : 0;
+    }
+
+    //payload indices for the triangles, lines and points of a Geometry
+    //encoded in its own space, lines and points only in mesh mode. each
+    //Geometry is encoded once and with by_content also each distinct vertex
+    //data. none for a Geometry without vertices, false when encoding failed
+    bool geometryPayloads(osg::Geometry& geometry, const DracoOptions& draco_options, bool by_content,
+        PayloadCache& payloads, DracoContainer& container, DracoStatistics& stats,
+        std::vector<int>& indices) const
+    {
+        std::map<const osg::Geometry*, std::vector<int> >::iterator itr = payloads.byPointer.find(&geometry);
+        if (itr != payloads.byPointer.end())
+        {
+            indices = itr->second;
+            return true;
+        }
+
+        indices.clear();
+        const GLenum modes[3] = { GL_TRIANGLES, GL_LINES, GL_POINTS };
+        const int num_modes = draco_options.is_point_cloud ? 1 : 3;
+        for (int m = 0; m < num_modes; m++)
+        {
+            GeometryFlat gf(m == 0 ? draco_options.is_point_cloud : false, 1, modes[m]);
+            gf.processGeomatry(geometry, osg::Matrix::identity());
+            if (!hasPrimitives(gf.m_geomtry_data, modes[m], draco_options)) continue;
+
+            int index = -1;
+            if (!primitivePayloadIndex(gf.m_geomtry_data, modes[m], draco_options, by_content,
+                payloads, container, stats, index))
+            {
+                return false;
+            }
+            indices.push_back(index);
+        }
+
+        payloads.byPointer[&geometry] = indices;
+        return true;
+    }
+
+    //blob index of one flattened primitive mode, content identical data is
+    //stored once with by_content. false when encoding failed
+    bool primitivePayloadIndex(const GeometryData& flat, GLenum mode, const DracoOptions& draco_options,
+        bool by_content, PayloadCache& payloads, DracoContainer& container, DracoStatistics& stats,
+        int& index) const
+    {
+        GeometryData data;
+        DracoOptions options;
+        const uint32_t blob_type = primitivePayload(flat, mode, draco_options, data, options);
+
+        //a mesh and a point cloud of the same data are different payloads
+        std::multimap<size_t, std::pair<GeometryData, int> >& by_content_mode =
+            payloads.byContent[mode == GL_TRIANGLES ? 0 : (mode == GL_LINES ? 1 : 2)];
+        size_t hash = 0;
+        if (by_content)
+        {
+            hash = hashGeometryData(data);
+            typedef std::multimap<size_t, std::pair<GeometryData, int> >::iterator ContentItr;
+            std::pair<ContentItr, ContentItr> range = by_content_mode.equal_range(hash);
+            for (ContentItr citr = range.first; citr != range.second; ++citr)
+            {
+                if (equalGeometryData(citr->second.first, data))
+                {
+                    index = citr->second.second;
+                    return true;
+                }
+            }
+        }
+
+        std::ostringstream payload(std::ios::out | std::ios::binary);
+        if (!encodeGeometryData(data, options, payload, stats)) return false;
+        index = container.addBlob(blob_type, payload.str());
+
+        if (by_content)
+        {
+            by_content_mode.insert(std::make_pair(hash, std::make_pair(data, index)));
+        }
+        return true;
+    }
 };
 
 REGISTER_OSGPLUGIN(drc, ReaderWriterDRC)
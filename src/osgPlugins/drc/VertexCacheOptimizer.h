@@ -0,0 +1,253 @@
+#ifndef OSGDB_DRC_VERTEX_CACHE_OPTIMIZER_H
+#define OSGDB_DRC_VERTEX_CACHE_OPTIMIZER_H
+
+#include <osg/Geometry>
+#include <osg/PrimitiveSet>
+
+#include <math.h>
+#include <string.h>
+
+#include <vector>
+
+//VertexCacheOptimizer
+//Tom Forsyth's linear speed vertex cache optimisation. triangles are emitted
+//greedily by a score that favours vertices in a simulated LRU cache and
+//vertices with few triangles left, then the vertices are renumbered in first
+//use order so the fetches walk the arrays forward.
+class VertexCacheOptimizer
+{
+public:
+
+    //reorder the triangles of every indexed TRIANGLES set of the Geometry and
+    //its per vertex arrays, the vertices only when no other sets use them.
+    //false when there was nothing to reorder
+    static bool optimize(osg::Geometry& geometry)
+    {
+        const osg::Array* vertices = geometry.getVertexArray();
+        if (!vertices || vertices->getNumElements() == 0) return false;
+        const size_t num_vertices = vertices->getNumElements();
+
+        //all triangle sets share one renumbering of the vertices
+        std::vector<osg::DrawElements*> sets;
+        std::vector<unsigned int> indices;
+        std::vector<size_t> ends;
+        for (unsigned int i = 0; i < geometry.getNumPrimitiveSets(); i++)
+        {
+            osg::DrawElements* elements = geometry.getPrimitiveSet(i)->getDrawElements();
+            if (!elements || elements->getMode() != GL_TRIANGLES || elements->getNumIndices() < 6) continue;
+
+            std::vector<unsigned int> set(elements->getNumIndices() / 3 * 3);
+            for (size_t k = 0; k < set.size(); k++) set[k] = elements->index(static_cast<unsigned int>(k));
+            if (!inRange(set, num_vertices)) continue;
+
+            optimizeTriangles(set, num_vertices);
+            sets.push_back(elements);
+            indices.insert(indices.end(), set.begin(), set.end());
+            ends.push_back(indices.size());
+        }
+        if (sets.empty()) return false;
+
+        //other primitive sets would need the same renumbering, keep the vertices then
+        const bool renumber = sets.size() == geometry.getNumPrimitiveSets();
+        std::vector<unsigned int> order;
+        if (renumber) order = optimizeVertices(indices, num_vertices);
+
+        size_t begin = 0;
+        for (size_t s = 0; s < sets.size(); s++)
+        {
+            osg::DrawElements* elements = sets[s];
+            elements->resizeElements(static_cast<unsigned int>(ends[s] - begin));
+            for (size_t k = begin; k < ends[s]; k++)
+            {
+                elements->setElement(static_cast<unsigned int>(k - begin), indices[k]);
+            }
+            elements->dirty();
+            begin = ends[s];
+        }
+        if (!renumber) return true;
+
+        reorderArray(geometry.getVertexArray(), order);
+        reorderArray(geometry.getNormalArray(), order);
+        reorderArray(geometry.getColorArray(), order);
+        reorderArray(geometry.getSecondaryColorArray(), order);
+        reorderArray(geometry.getFogCoordArray(), order);
+        for (unsigned int unit = 0; unit < geometry.getNumTexCoordArrays(); unit++)
+        {
+            reorderArray(geometry.getTexCoordArray(unit), order);
+        }
+        for (unsigned int index = 0; index < geometry.getNumVertexAttribArrays(); index++)
+        {
+            reorderArray(geometry.getVertexAttribArray(index), order);
+        }
+        geometry.dirtyBound();
+        return true;
+    }
+
+    //Forsyth triangle order of a triangle list indexing num_vertices vertices
+    static void optimizeTriangles(std::vector<unsigned int>& indices, size_t num_vertices)
+    {
+        const size_t num_triangles = indices.size() / 3;
+        if (num_triangles < 2) return;
+
+        //triangles of every vertex, remaining is the number not emitted yet
+        std::vector<unsigned int> offsets(num_vertices + 1, 0);
+        for (size_t i = 0; i < indices.size(); i++) offsets[indices[i] + 1]++;
+        for (size_t v = 0; v < num_vertices; v++) offsets[v + 1] += offsets[v];
+
+        std::vector<unsigned int> adjacency(indices.size());
+        std::vector<unsigned int> remaining(num_vertices, 0);
+        for (size_t i = 0; i < indices.size(); i++)
+        {
+            const unsigned int v = indices[i];
+            adjacency[offsets[v] + remaining[v]++] = static_cast<unsigned int>(i / 3);
+        }
+
+        std::vector<int> cache_position(num_vertices, -1);
+        std::vector<float> vertex_score(num_vertices);
+        for (size_t v = 0; v < num_vertices; v++) vertex_score[v] = score(-1, remaining[v]);
+
+        std::vector<bool> emitted(num_triangles, false);
+        std::vector<unsigned int> result;
+        result.reserve(indices.size());
+        std::vector<unsigned int> cache, next_cache;
+        size_t scan = 0;
+        long best = -1;
+
+        while (result.size() < num_triangles * 3)
+        {
+            //nothing left around the cache, go on with the first triangle left
+            if (best < 0)
+            {
+                while (emitted[scan]) scan++;
+                best = static_cast<long>(scan);
+            }
+
+            const unsigned int* triangle = &indices[best * 3];
+            emitted[best] = true;
+            result.insert(result.end(), triangle, triangle + 3);
+
+            for (int k = 0; k < 3; k++)
+            {
+                const unsigned int v = triangle[k];
+                unsigned int* list = &adjacency[offsets[v]];
+                for (unsigned int j = 0; j < remaining[v]; j++)
+                {
+                    if (list[j] != static_cast<unsigned int>(best)) continue;
+                    list[j] = list[remaining[v] - 1];
+                    remaining[v]--;
+                    break;
+                }
+            }
+
+            //the triangle moves to the front of the cache
+            next_cache.assign(triangle, triangle + 3);
+            for (size_t i = 0; i < cache.size(); i++)
+            {
+                const unsigned int v = cache[i];
+                if (v != triangle[0] && v != triangle[1] && v != triangle[2]) next_cache.push_back(v);
+            }
+            for (size_t i = 0; i < next_cache.size(); i++)
+            {
+                const unsigned int v = next_cache[i];
+                cache_position[v] = i < CACHE_SIZE ? static_cast<int>(i) : -1;
+                vertex_score[v] = score(cache_position[v], remaining[v]);
+            }
+
+            //best triangle still waiting on a cached vertex
+            best = -1;
+            float best_score = -1.0f;
+            for (size_t i = 0; i < next_cache.size() && i < CACHE_SIZE; i++)
+            {
+                const unsigned int v = next_cache[i];
+                const unsigned int* list = &adjacency[offsets[v]];
+                for (unsigned int j = 0; j < remaining[v]; j++)
+                {
+                    const unsigned int* t = &indices[list[j] * 3];
+                    const float s = vertex_score[t[0]] + vertex_score[t[1]] + vertex_score[t[2]];
+                    if (s > best_score)
+                    {
+                        best_score = s;
+                        best = list[j];
+                    }
+                }
+            }
+
+            if (next_cache.size() > CACHE_SIZE) next_cache.resize(static_cast<size_t>(CACHE_SIZE));
+            cache.swap(next_cache);
+        }
+
+        indices.swap(result);
+    }
+
+    //renumber the vertices in first use order, unused ones go last. returns
+    //the old index of every new vertex
+    static std::vector<unsigned int> optimizeVertices(std::vector<unsigned int>& indices, size_t num_vertices)
+    {
+        std::vector<unsigned int> remap(num_vertices, ~0u);
+        std::vector<unsigned int> order;
+        order.reserve(num_vertices);
+        for (size_t i = 0; i < indices.size(); i++)
+        {
+            unsigned int& to = remap[indices[i]];
+            if (to == ~0u)
+            {
+                to = static_cast<unsigned int>(order.size());
+                order.push_back(indices[i]);
+            }
+            indices[i] = to;
+        }
+        for (size_t v = 0; v < num_vertices; v++)
+        {
+            if (remap[v] == ~0u) order.push_back(static_cast<unsigned int>(v));
+        }
+        return order;
+    }
+
+private:
+
+    static const size_t CACHE_SIZE = 32;
+
+    static float score(int cache_position, unsigned int remaining)
+    {
+        //no triangle needs it any more
+        if (remaining == 0) return -1.0f;
+
+        float result = 0.0f;
+        if (cache_position >= 0)
+        {
+            //the last triangle's vertices get a fixed score so it is not reused at once
+            result = cache_position < 3 ? 0.75f
+                : powf(1.0f - (cache_position - 3) * (1.0f / (CACHE_SIZE - 3)), 1.5f);
+        }
+
+        //vertices with few triangles left are finished first
+        return result + 2.0f * powf(static_cast<float>(remaining), -0.5f);
+    }
+
+    static bool inRange(const std::vector<unsigned int>& indices, size_t num_vertices)
+    {
+        for (size_t i = 0; i < indices.size(); i++)
+        {
+            if (indices[i] >= num_vertices) return false;
+        }
+        return true;
+    }
+
+    //per vertex array into the new vertex order, other arrays are left alone
+    static void reorderArray(osg::Array* array, const std::vector<unsigned int>& order)
+    {
+        if (!array || array->getNumElements() != order.size()) return;
+
+        const unsigned int element_size = array->getElementSize();
+        std::vector<char> source(static_cast<const char*>(array->getDataPointer()),
+            static_cast<const char*>(array->getDataPointer()) + order.size() * element_size);
+        char* target = static_cast<char*>(const_cast<GLvoid*>(array->getDataPointer()));
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            memcpy(target + i * element_size, &source[order[i] * element_size], element_size);
+        }
+        array->dirty();
+    }
+};
+
+#endif